@@ -5,6 +5,35 @@
 #include <unordered_map>
 #include <string>
 #include <functional>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cctype>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define REDACTOR_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 enum class Channel {R, G, B};
 
@@ -33,17 +62,326 @@ public:
 	virtual int GetHeight() const = 0;
 	virtual int GetWidth() const = 0;
 	virtual Pixel& GetPixel(std::size_t y, std::size_t x) = 0;
+	virtual Pixel* GetRow(std::size_t y) = 0;
+	// Changes the dimensions; the pixel contents are unspecified afterwards.
+	virtual void Resize(int width, int height) = 0;
+	// Whether Write() stores the alpha channel, for formats that can go either way.
+	virtual void SetAlphaChannel(bool keep) = 0;
+};
+
+
+// A ring of image rows: row y lives in slot y % slots, so a window of 2r+1 slots
+// holds everything a filter of radius r needs to produce one row.
+class RowWindow {
+public:
+	RowWindow(Pixel* data, int width, int height, int slots) : data(data), width(width), height(height), slots(slots) {}
+
+	Pixel* GetRow(int y) const {
+		return data + static_cast<std::size_t>(y % slots) * width;
+	}
+
+	int GetWidth() const {
+		return width;
+	}
+
+	int GetHeight() const {
+		return height;
+	}
+
+private:
+	Pixel* data;
+	int width;
+	int height;
+	int slots;
+};
+
+
+// A point-wise colour transform compiled into lookup tables: a per-channel table,
+// an optional conversion to grey, then another per-channel table. Any chain of
+// point-wise filters folds into one of these, so applying the chain costs at most
+// three table lookups and one luma evaluation per pixel.
+class PointMap {
+public:
+	PointMap() {
+		for (int channel = 0; channel < 3; channel++) {
+			for (int value = 0; value < 256; value++) {
+				pre[channel][value] = value;
+				post[channel][value] = value;
+			}
+		}
+	}
+
+	// Appends value -> map(channel, value) to the transform.
+	template <class Map>
+	void AppendChannelMap(Map map) {
+		auto& lut = luma ? post : pre;
+		for (Channel channel : { Channel::R, Channel::G, Channel::B }) {
+			uint8_t* table = lut[static_cast<int>(channel)];
+			for (int value = 0; value < 256; value++) {
+				table[value] = map(channel, table[value]);
+			}
+		}
+	}
+
+	// Appends the conversion to grey. A second conversion is a function of the first grey level alone.
+	void AppendLuma() {
+		if (!luma) {
+			luma = true;
+			return;
+		}
+		for (int value = 0; value < 256; value++) {
+			uint8_t grey = Luma(post[B][value], post[G][value], post[R][value]);
+			post[B][value] = grey;
+			post[G][value] = grey;
+			post[R][value] = grey;
+		}
+	}
+
+	void ApplyRow(const Pixel* row, Pixel* out, int width) const {
+		if (!luma) {
+			for (int x = 0; x < width; x++) {
+				out[x].B = pre[B][row[x].B];
+				out[x].G = pre[G][row[x].G];
+				out[x].R = pre[R][row[x].R];
+				out[x].A = row[x].A;
+			}
+			return;
+		}
+		for (int x = 0; x < width; x++) {
+			uint8_t grey = Luma(pre[B][row[x].B], pre[G][row[x].G], pre[R][row[x].R]);
+			out[x].B = post[B][grey];
+			out[x].G = post[G][grey];
+			out[x].R = post[R][grey];
+			out[x].A = row[x].A;
+		}
+	}
+
+	// 0.114 B + 0.587 G + 0.299 R in 8.24 fixed point; the weights add up to 2^24 + 1, so white stays 255.
+	static uint8_t Luma(uint8_t b, uint8_t g, uint8_t r) {
+		return (b * 1912603u + g * 9848226u + r * 5016388u) >> 24;
+	}
+
+private:
+	static const int R = static_cast<int>(Channel::R);
+	static const int G = static_cast<int>(Channel::G);
+	static const int B = static_cast<int>(Channel::B);
+
+	uint8_t pre[3][256];
+	uint8_t post[3][256];
+	bool luma = false;
 };
 
 
+class RowStage;
+
+
 class Filter {
 public:
 	virtual ~Filter() = default;
 	virtual std::size_t GetArity() const = 0;
 	virtual void SetArguments(std::size_t n, const std::string& arg) = 0;
-	virtual void Apply(Image& image) const = 0;
+	virtual void Apply(Image& image) const;
+	// Number of rows above and below the produced one the filter reads, 0 for point-wise filters.
+	virtual int GetRadius() const {
+		return 0;
+	}
+	// Filters that need the whole image at once (e.g. to gather statistics) cannot run row by row.
+	virtual bool IsStreamable() const {
+		return true;
+	}
+	// Produces row y from rows [y - GetRadius(), y + GetRadius()] of the window.
+	// For point-wise filters out may be the window row itself.
+	virtual void ApplyRow(const RowWindow& /*window*/, int /*y*/, Pixel* /*out*/) const {
+		throw std::runtime_error("Error! The filter cannot be applied row by row");
+	}
+	// Point-wise filters append themselves to the map and return true.
+	virtual bool AppendPointMap(PointMap&) const {
+		return false;
+	}
+	// The step that runs the filter inside a RowPipeline; by default a window of 2r+1 rows around ApplyRow().
+	virtual std::unique_ptr<RowStage> MakeStage(int width, int height) const;
+};
+
+
+// One step of a RowPipeline: takes rows bottom to top and passes the rows it produces on.
+class RowStage {
+public:
+	using Sink = std::function<void(int y, Pixel* row)>;
+
+	RowStage(int output_width, int output_height) : output_width(output_width), output_height(output_height) {}
+	virtual ~RowStage() = default;
+
+	// Rows must come in order; the stage is free to modify the pushed row.
+	virtual void Push(int y, Pixel* row) = 0;
+	// Produces the rows still waiting for their neighbours once the last row was pushed.
+	virtual void Finish() {}
+
+	void SetSink(Sink new_sink) {
+		sink = std::move(new_sink);
+	}
+
+	int GetOutputWidth() const {
+		return output_width;
+	}
+
+	int GetOutputHeight() const {
+		return output_height;
+	}
+
+protected:
+	Sink sink;
+	int output_width;
+	int output_height;
+};
+
+
+// Runs a filter over a ring of 2r+1 rows, so memory use does not depend on the image height.
+class WindowStage : public RowStage {
+public:
+	WindowStage(const Filter& filter, int width, int height) : RowStage(width, height), filter(filter), radius(filter.GetRadius()) {
+		if (!filter.IsStreamable()) {
+			throw std::runtime_error("Error! The filter cannot be applied row by row");
+		}
+		if (radius > 0) {
+			ring.resize(static_cast<std::size_t>(width) * (2 * radius + 1));
+			out.resize(width);
+		}
+	}
+
+	void Push(int y, Pixel* row) override {
+		if (radius == 0) {
+			filter.ApplyRow(RowWindow(row, output_width, output_height, 1), y, row);
+			sink(y, row);
+			return;
+		}
+		std::copy(row, row + output_width, GetWindow().GetRow(y));
+		if (y >= radius) {
+			Produce(y - radius);
+		}
+	}
+
+	void Finish() override {
+		for (int y = std::max(0, output_height - radius); y < output_height; y++) {
+			Produce(y);
+		}
+	}
+
+private:
+	const Filter& filter;
+	int radius;
+	std::vector<Pixel> ring;
+	std::vector<Pixel> out;
+
+	RowWindow GetWindow() {
+		return RowWindow(ring.data(), output_width, output_height, 2 * radius + 1);
+	}
+
+	void Produce(int y) {
+		filter.ApplyRow(GetWindow(), y, out.data());
+		sink(y, out.data());
+	}
+};
+
+
+inline std::unique_ptr<RowStage> Filter::MakeStage(int width, int height) const {
+	return std::make_unique<WindowStage>(*this, width, height);
+}
+
+
+// Pushes rows bottom to top through a chain of filters, each running as its own stage.
+class RowPipeline {
+public:
+	using Sink = RowStage::Sink;
+
+	RowPipeline(const std::vector<const Filter*>& filters, int width, int height, Sink sink) : output_width(width), output_height(height), sink(std::move(sink)) {
+		for (const Filter* filter : filters) {
+			stages.push_back(filter->MakeStage(output_width, output_height));
+			resizes = resizes || stages.back()->GetOutputWidth() != output_width || stages.back()->GetOutputHeight() != output_height;
+			output_width = stages.back()->GetOutputWidth();
+			output_height = stages.back()->GetOutputHeight();
+		}
+		for (std::size_t index = 0; index + 1 < stages.size(); index++) {
+			RowStage* next = stages[index + 1].get();
+			stages[index]->SetSink([next](int y, Pixel* row) { next->Push(y, row); });
+		}
+		if (!stages.empty()) {
+			stages.back()->SetSink(this->sink);
+		}
+	}
+
+	// Rows must come in order; the pipeline is free to modify the pushed row.
+	void Push(int y, Pixel* row) {
+		if (stages.empty()) {
+			sink(y, row);
+		} else {
+			stages.front()->Push(y, row);
+		}
+	}
+
+	void Finish() {
+		for (std::unique_ptr<RowStage>& stage : stages) {
+			stage->Finish();
+		}
+	}
+
+	int GetOutputWidth() const {
+		return output_width;
+	}
+
+	int GetOutputHeight() const {
+		return output_height;
+	}
+
+	// Whether some stage changes the image size, in which case rows no longer come out
+	// in step with the rows going in.
+	bool Resizes() const {
+		return resizes;
+	}
+
+private:
+	int output_width;
+	int output_height;
+	bool resizes = false;
+	Sink sink;
+	std::vector<std::unique_ptr<RowStage>> stages;
 };
 
+
+// Runs a chain of row filters over an image in a single pass. The results are written
+// back in place unless the chain changes the image size.
+inline void ApplyRowFilters(Image& image, const std::vector<const Filter*>& filters) {
+	std::vector<Pixel> resized;
+	bool in_place = true;
+	int out_width = 0;
+	RowPipeline pipeline(filters, image.GetWidth(), image.GetHeight(), [&](int y, Pixel* row) {
+		Pixel* target = in_place ? image.GetRow(y) : resized.data() + static_cast<std::size_t>(y) * out_width;
+		if (row != target) {
+			std::copy(row, row + out_width, target);
+		}
+	});
+	out_width = pipeline.GetOutputWidth();
+	in_place = !pipeline.Resizes();
+	if (!in_place) {
+		resized.resize(static_cast<std::size_t>(out_width) * pipeline.GetOutputHeight());
+	}
+	for (int y = 0; y < image.GetHeight(); y++) {
+		pipeline.Push(y, image.GetRow(y));
+	}
+	pipeline.Finish();
+	if (!in_place) {
+		image.Resize(out_width, pipeline.GetOutputHeight());
+		for (int y = 0; y < image.GetHeight(); y++) {
+			std::copy(resized.begin() + static_cast<std::size_t>(y) * out_width, resized.begin() + static_cast<std::size_t>(y + 1) * out_width, image.GetRow(y));
+		}
+	}
+}
+
+
+inline void Filter::Apply(Image& image) const {
+	ApplyRowFilters(image, { this });
+}
+
+
 #pragma pack(push, 1)
 
 struct BMPFileHeader {
@@ -81,6 +419,81 @@ struct BMPColorHeader {
 
 #pragma pack(pop)
 
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() {
+		Close();
+	}
+
+	// Shared mappings write changes straight back to the file, private ones are copy-on-write.
+	bool Open(const std::string& path, bool shared) {
+		Close();
+#ifdef REDACTOR_HAS_MMAP
+		int fd = open(path.c_str(), shared ? O_RDWR : O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			close(fd);
+			return false;
+		}
+		void* addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED) {
+			return false;
+		}
+		madvise(addr, st.st_size, MADV_SEQUENTIAL);
+		data = static_cast<uint8_t*>(addr);
+		size = st.st_size;
+		is_shared = shared;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void Flush() {
+#ifdef REDACTOR_HAS_MMAP
+		if (data != nullptr && is_shared) {
+			msync(data, size, MS_SYNC);
+		}
+#endif
+	}
+
+	void Close() {
+#ifdef REDACTOR_HAS_MMAP
+		if (data != nullptr) {
+			munmap(data, size);
+		}
+#endif
+		data = nullptr;
+		size = 0;
+		is_shared = false;
+	}
+
+	uint8_t* GetData() const {
+		return data;
+	}
+
+	std::size_t GetSize() const {
+		return size;
+	}
+
+	bool IsShared() const {
+		return is_shared;
+	}
+
+private:
+	uint8_t* data = nullptr;
+	std::size_t size = 0;
+	bool is_shared = false;
+};
+
+
 class BMP : public Image {
 public:
 	BMPFileHeader file_header;
@@ -89,7 +502,125 @@ public:
 	std::vector<Pixel> pixel_data;
 
 	void Read(std::ifstream& file) override {
-		std::vector<uint8_t> temp_data;
+		mapping.Close();
+		ReadHeaders(file);
+		std::size_t pixel_count = static_cast<std::size_t>(info_header.width) * info_header.height;
+		pixel_data.resize(pixel_count);
+		pixels = pixel_data.data();
+		if (info_header.bit_count == 32) {
+			file.read(reinterpret_cast<char*>(pixels), pixel_count * sizeof(Pixel));
+		} else {
+			std::vector<uint8_t> temp_data(GetPaddedStride() * info_header.height);
+			file.read(reinterpret_cast<char*>(temp_data.data()), temp_data.size());
+			ConvertBitsToPixels(temp_data);
+		}
+		if (!file) {
+			throw std::runtime_error("Error! Unexpected end of file");
+		}
+	}
+
+	// Maps a 32 bit image straight into memory so that filters edit the file pages in place.
+	// With in_place set the changes land in the source file itself and Flush() replaces Write().
+	// Returns false when the image has to go through Read() instead.
+	bool Map(const std::string& path, bool in_place) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			throw std::runtime_error("Error! Unable to open the file");
+		}
+		uint32_t pixel_offset = ReadHeaders(file);
+		if (info_header.bit_count != 32 || !mapping.Open(path, in_place)) {
+			return false;
+		}
+		std::size_t pixel_bytes = static_cast<std::size_t>(info_header.width) * info_header.height * sizeof(Pixel);
+		if (mapping.GetSize() < pixel_offset + pixel_bytes) {
+			mapping.Close();
+			throw std::runtime_error("Error! Unexpected end of file");
+		}
+		pixel_data.clear();
+		pixels = reinterpret_cast<Pixel*>(mapping.GetData() + pixel_offset);
+		return true;
+	}
+
+	bool IsMappedInPlace() const {
+		return mapping.IsShared();
+	}
+
+	void Flush() {
+		mapping.Flush();
+	}
+
+	void Write(std::ofstream& file) const override {
+		WriteHeaders(file);
+		if (info_header.bit_count == 32) {
+			file.write(reinterpret_cast<const char*>(pixels), GetPixelCount() * sizeof(Pixel));
+		} else if (info_header.bit_count == 24) {
+			std::vector<uint8_t> temp_data;
+			ConvertPixelsToBits(temp_data);
+			file.write(reinterpret_cast<const char*>(temp_data.data()), temp_data.size());
+		} else {
+			throw std::runtime_error("Error! Only 24 or 32 bits per pixel BMP files can be written");
+		}
+	}
+
+	int GetHeight() const override {
+		return info_header.height;
+	}
+
+	int GetWidth() const override {
+		return info_header.width;
+	}
+
+	Pixel& GetPixel(std::size_t y, std::size_t x) override {
+		return pixels[y * info_header.width + x];
+	}
+
+	Pixel* GetRow(std::size_t y) override {
+		return pixels + y * info_header.width;
+	}
+
+	void Resize(int width, int height) override {
+		mapping.Close();
+		SetSize(width, height);
+		pixel_data.resize(GetPixelCount());
+		pixels = pixel_data.data();
+	}
+
+	void SetAlphaChannel(bool keep) override {
+		info_header.bit_count = keep ? 32 : 24;
+		info_header.compression = keep ? 3 : 0;
+		info_header.header_size = keep ? sizeof(BMPInfoHeader) + sizeof(BMPColorHeader) : sizeof(BMPInfoHeader);
+		file_header.pixel_data = sizeof(BMPFileHeader) + info_header.header_size;
+		SetSize(info_header.width, info_header.height);
+	}
+
+	// Converts the whole pixel area from and to its layout in the file, for images kept encoded in memory.
+	void DecodePixels(const std::vector<uint8_t>& bits) {
+		if (info_header.bit_count == 32) {
+			std::copy(bits.begin(), bits.begin() + GetPixelCount() * sizeof(Pixel), reinterpret_cast<uint8_t*>(pixels));
+		} else {
+			ConvertBitsToPixels(bits);
+		}
+	}
+
+	void EncodePixels(std::vector<uint8_t>& bits) const {
+		if (info_header.bit_count == 32) {
+			const uint8_t* begin = reinterpret_cast<const uint8_t*>(pixels);
+			bits.assign(begin, begin + GetPixelCount() * sizeof(Pixel));
+		} else {
+			ConvertPixelsToBits(bits);
+		}
+	}
+
+	// Updates the headers only, for images that are written row by row.
+	void SetSize(int width, int height) {
+		info_header.width = width;
+		info_header.height = height;
+		info_header.size_image = GetPaddedStride() * height;
+		file_header.file_size = file_header.pixel_data + info_header.size_image;
+	}
+
+	// Reads and validates the headers, normalizes them for writing and returns the offset of the pixel data in the file.
+	uint32_t ReadHeaders(std::istream& file) {
 		file.read(reinterpret_cast<char*>(&file_header), sizeof(file_header));
 		if (file_header.file_type != 0x4D42) {
 			throw std::runtime_error("Error! Wrong file format");
@@ -102,74 +633,60 @@ public:
 			} else {
 				throw std::runtime_error("Error! Unrecognized file format: the file does not seem to contain bit mask information");
 			}
-
+		} else if (info_header.bit_count != 24) {
+			throw std::runtime_error("Error! Only 24 or 32 bits per pixel BMP files can be read");
+		}
+		if (info_header.height < 0) {
+			throw std::runtime_error("The program can treat only BMP images with the origin in the bottom left corner!");
 		}
-		file.seekg(file_header.pixel_data, file.beg);
+		uint32_t pixel_offset = file_header.pixel_data;
+		file.seekg(pixel_offset, file.beg);
 		if (info_header.bit_count == 32) {
 			info_header.header_size = sizeof(BMPInfoHeader) + sizeof(BMPColorHeader);
 			file_header.pixel_data = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader) + sizeof(BMPColorHeader);
-
 		} else {
 			info_header.header_size = sizeof(BMPInfoHeader);
 			file_header.pixel_data = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader);
 		}
-		file_header.file_size = file_header.pixel_data;
-		if (info_header.height < 0) { 
-			throw std::runtime_error("The program can treat only BMP images with the origin in the bottom left corner!");
+		file_header.file_size = file_header.pixel_data + GetPaddedStride() * info_header.height;
+		return pixel_offset;
+	}
+
+	// Row by row access for the streaming mode: ReadHeaders() leaves the stream at the first row.
+	void ReadRow(std::istream& file, Pixel* row, std::vector<uint8_t>& buffer) const {
+		buffer.resize(GetPaddedStride());
+		file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+		if (!file) {
+			throw std::runtime_error("Error! Unexpected end of file");
 		}
-		temp_data.resize(info_header.width * info_header.height * info_header.bit_count / 8); 
-		if (info_header.width % 4 == 0) {
-			file.read(reinterpret_cast<char*>(temp_data.data()), temp_data.size());
-			file_header.file_size += temp_data.size();
+		if (info_header.bit_count == 32) {
+			std::copy(buffer.begin(), buffer.end(), reinterpret_cast<uint8_t*>(row));
 		} else {
-			row_stride = info_header.width * info_header.bit_count / 8;
-			uint32_t new_stride = MakeStrideAligned(4, row_stride);
-			std::vector<uint8_t> padding_row(new_stride - row_stride);
-			for (int y = 0; y < info_header.height; ++y) {
-				file.read(reinterpret_cast<char*>(temp_data.data() + row_stride * y), row_stride);
-				file.read(reinterpret_cast<char*>(padding_row.data()), padding_row.size());
-			}
-			file_header.file_size += temp_data.size() + info_header.height * padding_row.size();
+			UnpackRow24(buffer.data(), row, info_header.width);
 		}
-		ConvertBitsToPixels(temp_data);
 	}
 
-	void Write(std::ofstream& file) const override {
-		std::vector<uint8_t> temp_data;
-		ConvertPixelsToBits(temp_data);
+	void WriteRow(std::ostream& file, const Pixel* row, std::vector<uint8_t>& buffer) const {
+		buffer.assign(GetPaddedStride(), 0);
 		if (info_header.bit_count == 32) {
-			WriteFile(file, temp_data);
-		} else if (info_header.bit_count == 24) {
-			if (info_header.width % 4 == 0) {
-				WriteFile(file, temp_data);
-			} else {
-				uint32_t new_stride = MakeStrideAligned(4, row_stride);
-				std::vector<uint8_t> padding_row(new_stride - row_stride);
-				WriteHeaders(file);
-				for (int y = 0; y < info_header.height; ++y) {
-					file.write(reinterpret_cast<const char*>(temp_data.data() + row_stride * y), row_stride);
-					file.write(reinterpret_cast<const char*>(padding_row.data()), padding_row.size());
-				}
-			}
+			std::copy(row, row + info_header.width, reinterpret_cast<Pixel*>(buffer.data()));
 		} else {
-			throw std::runtime_error("Error! Only 24 or 32 bits per pixel BMP files can be written");
+			PackRow24(row, buffer.data(), info_header.width);
 		}
+		file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
 	}
 
-	int GetHeight() const override {
-		return info_header.height;
-	}
-
-	int GetWidth() const override {
-		return info_header.width;
-	}
-
-	Pixel& GetPixel(std::size_t y, std::size_t x) override {
-		return pixel_data[y * info_header.width + x];
+	void WriteHeaders(std::ostream& file) const {
+		file.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+		file.write(reinterpret_cast<const char*>(&info_header), sizeof(info_header));
+		if (info_header.bit_count == 32) {
+			file.write(reinterpret_cast<const char*>(&color_header), sizeof(color_header));
+		}
 	}
 
 private:
-	uint32_t row_stride = 0;
+	Pixel* pixels = nullptr;
+	MappedFile mapping;
 
 	static void CheckColorHeader(const BMPColorHeader& color_header) {
 		BMPColorHeader color_header_ref;
@@ -184,84 +701,618 @@ private:
 		}
 	}
 
-	static uint32_t MakeStrideAligned(uint32_t align_stride, int32_t cur_stride) {
-		return cur_stride + (align_stride - (cur_stride % align_stride)); 
+	std::size_t GetPixelCount() const {
+		return static_cast<std::size_t>(info_header.width) * info_header.height;
 	}
 
-	void WriteHeaders(std::ofstream& file) const {
-		file.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
-		file.write(reinterpret_cast<const char*>(&info_header), sizeof(info_header));
-		if (info_header.bit_count == 32) {
-			file.write(reinterpret_cast<const char*>(&color_header), sizeof(color_header));
-		}
-	}
-
-	void WriteFile(std::ofstream& file, const std::vector<uint8_t>& data) const {
-		WriteHeaders(file);
-		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	// Rows are padded to a multiple of 4 bytes.
+	std::size_t GetPaddedStride() const {
+		std::size_t row_stride = static_cast<std::size_t>(info_header.width) * info_header.bit_count / 8;
+		return (row_stride + 3) & ~static_cast<std::size_t>(3);
 	}
 
 	void ConvertBitsToPixels(const std::vector<uint8_t>& bits) {
-		uint32_t channels = info_header.bit_count / 8;
-		for (std::size_t index = 0; index < bits.size(); index += channels) {
-			Pixel pixel;
-			pixel.B = bits[index];
-			pixel.G = bits[index + 1];
-			pixel.R = bits[index + 2];
-			if (channels == 4) {
-				pixel.A = bits[index + 3];
-			}
-			pixel_data.push_back(pixel);
+		std::size_t stride = GetPaddedStride();
+		for (int y = 0; y < info_header.height; y++) {
+			UnpackRow24(bits.data() + stride * y, pixels + static_cast<std::size_t>(info_header.width) * y, info_header.width);
 		}
 	}
 
 	void ConvertPixelsToBits(std::vector<uint8_t>& bits) const {
-		uint32_t channels = info_header.bit_count / 8;
-		for (std::size_t index = 0; index < pixel_data.size(); index++) {
-			bits.push_back(pixel_data[index].B);
-			bits.push_back(pixel_data[index].G);
-			bits.push_back(pixel_data[index].R);
-			if (channels == 4) {
-				bits.push_back(pixel_data[index].A);
-			}
+		std::size_t stride = GetPaddedStride();
+		bits.assign(stride * info_header.height, 0);
+		for (int y = 0; y < info_header.height; y++) {
+			PackRow24(pixels + static_cast<std::size_t>(info_header.width) * y, bits.data() + stride * y, info_header.width);
 		}
 	}
-};
-
 
-class DiscolorFilter : public Filter {
-public:
-	DiscolorFilter() = default;
-	std::size_t GetArity() const override {
-		return 0;
-	}
-	void SetArguments(std::size_t n, const std::string& arg) override {
-		if (n >= GetArity()) {
-			throw std::runtime_error("Error! Wromg number of arguments");
+	static void UnpackRow24(const uint8_t* src, Pixel* dst, std::size_t width) {
+		std::size_t x = 0;
+#ifdef __SSSE3__
+		const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32(0xFF000000);
+		// A 16 byte load covers 4 pixels plus 4 bytes of the next ones, so stay 6 pixels away from the row end.
+		for (; x + 6 <= width; x += 4) {
+			__m128i bgr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 3));
+			__m128i bgra = _mm_or_si128(_mm_shuffle_epi8(bgr, shuffle), alpha);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), bgra);
+		}
+#endif
+		for (; x < width; x++) {
+			dst[x].B = src[x * 3];
+			dst[x].G = src[x * 3 + 1];
+			dst[x].R = src[x * 3 + 2];
+			dst[x].A = 255;
 		}
-		return;
-	}
-	void Apply(Image& image) const override {
-		discolor(image);
 	}
-private:
-	static void discolor(Image& image) {
-		for (std::size_t y = 0; y < image.GetHeight(); y++) {
-			for (std::size_t x = 0; x < image.GetWidth(); x++) {
-				uint8_t color = image.GetPixel(y, x).B * 0.114 + image.GetPixel(y, x).G * 0.587 + image.GetPixel(y, x).R * 0.299;
-				image.GetPixel(y, x).B = color;
-				image.GetPixel(y, x).G = color;
-				image.GetPixel(y, x).R = color;
-			}
+
+	static void PackRow24(const Pixel* src, uint8_t* dst, std::size_t width) {
+		std::size_t x = 0;
+#ifdef __SSSE3__
+		const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		// The 16 byte store spills 4 zero bytes that the following iteration or the tail overwrites.
+		for (; x + 6 <= width; x += 4) {
+			__m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 3), _mm_shuffle_epi8(bgra, shuffle));
+		}
+#endif
+		for (; x < width; x++) {
+			dst[x * 3] = src[x].B;
+			dst[x * 3 + 1] = src[x].G;
+			dst[x * 3 + 2] = src[x].R;
 		}
 	}
 };
 
 
-class LightenFilter : public Filter {
+// Pixel storage for the formats that are always decoded into memory. Like in BMP,
+// row 0 is the bottom row of the picture.
+class RasterImage : public Image {
 public:
-	std::size_t GetArity() const override {
-		return 1;
+	int GetHeight() const override {
+		return height;
+	}
+
+	int GetWidth() const override {
+		return width;
+	}
+
+	Pixel& GetPixel(std::size_t y, std::size_t x) override {
+		return pixel_data[y * width + x];
+	}
+
+	Pixel* GetRow(std::size_t y) override {
+		return pixel_data.data() + y * width;
+	}
+
+	void Resize(int new_width, int new_height) override {
+		width = new_width;
+		height = new_height;
+		pixel_data.resize(static_cast<std::size_t>(width) * height);
+	}
+
+protected:
+	int width = 0;
+	int height = 0;
+	std::vector<Pixel> pixel_data;
+
+	// The file stores row `index` counted from the top or from the bottom of the picture.
+	Pixel* GetFileRow(int index, bool top_down) {
+		return GetRow(top_down ? height - 1 - index : index);
+	}
+
+	const Pixel* GetFileRow(int index, bool top_down) const {
+		return pixel_data.data() + static_cast<std::size_t>(top_down ? height - 1 - index : index) * width;
+	}
+
+	static void CheckSize(int64_t new_width, int64_t new_height) {
+		if (new_width <= 0 || new_height <= 0 || new_width > (1 << 20) || new_height > (1 << 20)) {
+			throw std::runtime_error("Error! Wrong image size");
+		}
+	}
+};
+
+
+// Binary PGM (P5, grey) and PPM (P6, RGB) with 8 bit samples.
+class PNM : public RasterImage {
+public:
+	explicit PNM(bool grey) : grey(grey) {}
+
+	void Read(std::ifstream& file) override {
+		std::string magic = ReadToken(file);
+		if (magic != "P5" && magic != "P6") {
+			throw std::runtime_error("Error! Wrong file format");
+		}
+		grey = magic == "P5";
+		int64_t new_width = std::stoll(ReadToken(file));
+		int64_t new_height = std::stoll(ReadToken(file));
+		if (std::stoi(ReadToken(file)) != 255) {
+			throw std::runtime_error("Error! Only 8 bit PGM/PPM files can be read");
+		}
+		file.get();
+		CheckSize(new_width, new_height);
+		Resize(new_width, new_height);
+		int channels = grey ? 1 : 3;
+		std::vector<uint8_t> buffer(static_cast<std::size_t>(width) * height * channels);
+		file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+		if (!file) {
+			throw std::runtime_error("Error! Unexpected end of file");
+		}
+		for (int index = 0; index < height; index++) {
+			const uint8_t* source = buffer.data() + static_cast<std::size_t>(index) * width * channels;
+			Pixel* row = GetFileRow(index, true);
+			for (int x = 0; x < width; x++) {
+				if (grey) {
+					row[x].B = row[x].G = row[x].R = source[x];
+				} else {
+					row[x].R = source[x * 3];
+					row[x].G = source[x * 3 + 1];
+					row[x].B = source[x * 3 + 2];
+				}
+				row[x].A = 255;
+			}
+		}
+	}
+
+	void Write(std::ofstream& file) const override {
+		file << (grey ? "P5" : "P6") << '\n' << width << ' ' << height << "\n255\n";
+		int channels = grey ? 1 : 3;
+		std::vector<uint8_t> buffer(static_cast<std::size_t>(width) * height * channels);
+		for (int index = 0; index < height; index++) {
+			uint8_t* target = buffer.data() + static_cast<std::size_t>(index) * width * channels;
+			const Pixel* row = GetFileRow(index, true);
+			for (int x = 0; x < width; x++) {
+				if (grey) {
+					target[x] = PointMap::Luma(row[x].B, row[x].G, row[x].R);
+				} else {
+					target[x * 3] = row[x].R;
+					target[x * 3 + 1] = row[x].G;
+					target[x * 3 + 2] = row[x].B;
+				}
+			}
+		}
+		file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	}
+
+	void SetAlphaChannel(bool) override {}
+
+private:
+	bool grey;
+
+	// Whitespace separated header token; '#' starts a comment that runs to the end of the line.
+	static std::string ReadToken(std::istream& file) {
+		std::string token;
+		int c = file.get();
+		while (c != EOF && (std::isspace(c) || c == '#')) {
+			if (c == '#') {
+				while (c != EOF && c != '\n') {
+					c = file.get();
+				}
+			}
+			c = file.get();
+		}
+		while (c != EOF && !std::isspace(c)) {
+			token.push_back(static_cast<char>(c));
+			c = file.get();
+		}
+		if (c != EOF) {
+			file.unget();
+		}
+		if (token.empty()) {
+			throw std::runtime_error("Error! Unexpected end of file");
+		}
+		return token;
+	}
+};
+
+
+#pragma pack(push, 1)
+
+struct TGAHeader {
+	uint8_t id_length = 0;
+	uint8_t color_map_type = 0;
+	uint8_t image_type = 2;
+	uint16_t color_map_first = 0;
+	uint16_t color_map_length = 0;
+	uint8_t color_map_bits = 0;
+	uint16_t x_origin = 0;
+	uint16_t y_origin = 0;
+	uint16_t width = 0;
+	uint16_t height = 0;
+	uint8_t bit_count = 24;
+	uint8_t descriptor = 0;
+};
+
+#pragma pack(pop)
+
+
+// Uncompressed TGA: true colour (type 2, 24 or 32 bit) and grey (type 3, 8 bit).
+// Pixels are stored B, G, R(, A) like in BMP, so rows convert with the BMP row helpers.
+class TGA : public RasterImage {
+public:
+	void Read(std::ifstream& file) override {
+		TGAHeader header;
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!file || header.color_map_type != 0 || !(
+			(header.image_type == 2 && (header.bit_count == 24 || header.bit_count == 32)) ||
+			(header.image_type == 3 && header.bit_count == 8))) {
+			throw std::runtime_error("Error! Only uncompressed 8, 24 or 32 bits per pixel TGA files can be read");
+		}
+		file.seekg(header.id_length, file.cur);
+		CheckSize(header.width, header.height);
+		Resize(header.width, header.height);
+		bit_count = header.image_type == 3 ? 24 : header.bit_count;
+		bool top_down = (header.descriptor & 0x20) != 0;
+		bool right_to_left = (header.descriptor & 0x10) != 0;
+		int channels = header.bit_count / 8;
+		std::vector<uint8_t> buffer(static_cast<std::size_t>(width) * height * channels);
+		file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+		if (!file) {
+			throw std::runtime_error("Error! Unexpected end of file");
+		}
+		for (int index = 0; index < height; index++) {
+			const uint8_t* source = buffer.data() + static_cast<std::size_t>(index) * width * channels;
+			Pixel* row = GetFileRow(index, top_down);
+			for (int x = 0; x < width; x++) {
+				Pixel& pixel = row[right_to_left ? width - 1 - x : x];
+				pixel.B = source[x * channels];
+				pixel.G = source[x * channels + (channels > 1 ? 1 : 0)];
+				pixel.R = source[x * channels + (channels > 1 ? 2 : 0)];
+				pixel.A = channels == 4 ? source[x * channels + 3] : 255;
+			}
+		}
+	}
+
+	void Write(std::ofstream& file) const override {
+		TGAHeader header;
+		header.width = static_cast<uint16_t>(width);
+		header.height = static_cast<uint16_t>(height);
+		header.bit_count = bit_count;
+		header.descriptor = bit_count == 32 ? 8 : 0;
+		if (width > 0xFFFF || height > 0xFFFF) {
+			throw std::runtime_error("Error! The image is too large for TGA");
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		int channels = bit_count / 8;
+		std::vector<uint8_t> buffer(static_cast<std::size_t>(width) * height * channels);
+		for (int y = 0; y < height; y++) {
+			uint8_t* target = buffer.data() + static_cast<std::size_t>(y) * width * channels;
+			const Pixel* row = pixel_data.data() + static_cast<std::size_t>(y) * width;
+			for (int x = 0; x < width; x++) {
+				target[x * channels] = row[x].B;
+				target[x * channels + 1] = row[x].G;
+				target[x * channels + 2] = row[x].R;
+				if (channels == 4) {
+					target[x * channels + 3] = row[x].A;
+				}
+			}
+		}
+		file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	}
+
+	void SetAlphaChannel(bool keep) override {
+		bit_count = keep ? 32 : 24;
+	}
+
+private:
+	uint8_t bit_count = 24;
+};
+
+
+// The "Quite OK Image" format: lossless, with a run/index/difference encoding that
+// packs typical images to a fraction of their BMP size at close to memcpy speed.
+class QOI : public RasterImage {
+public:
+	void Read(std::ifstream& file) override {
+		std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (bytes.size() < header_size + sizeof(end_marker) || std::memcmp(bytes.data(), "qoif", 4) != 0) {
+			throw std::runtime_error("Error! Wrong file format");
+		}
+		int64_t new_width = ReadBigEndian(bytes.data() + 4);
+		int64_t new_height = ReadBigEndian(bytes.data() + 8);
+		channels = bytes[12];
+		if (channels != 3 && channels != 4) {
+			throw std::runtime_error("Error! Wrong file format");
+		}
+		CheckSize(new_width, new_height);
+		Resize(new_width, new_height);
+		Pixel index[64] = {};
+		for (Pixel& pixel : index) {
+			pixel.A = 0;
+		}
+		Pixel pixel;
+		std::size_t pos = header_size;
+		std::size_t end = bytes.size() - sizeof(end_marker);
+		int run = 0;
+		for (int line = 0; line < height; line++) {
+			Pixel* row = GetFileRow(line, true);
+			for (int x = 0; x < width; x++) {
+				if (run > 0) {
+					run--;
+				} else if (pos < end) {
+					uint8_t b1 = bytes[pos++];
+					if (b1 == op_rgb) {
+						pixel.R = bytes[pos];
+						pixel.G = bytes[pos + 1];
+						pixel.B = bytes[pos + 2];
+						pos += 3;
+					} else if (b1 == op_rgba) {
+						pixel.R = bytes[pos];
+						pixel.G = bytes[pos + 1];
+						pixel.B = bytes[pos + 2];
+						pixel.A = bytes[pos + 3];
+						pos += 4;
+					} else if ((b1 & op_mask) == op_index) {
+						pixel = index[b1];
+					} else if ((b1 & op_mask) == op_diff) {
+						pixel.R += ((b1 >> 4) & 0x03) - 2;
+						pixel.G += ((b1 >> 2) & 0x03) - 2;
+						pixel.B += (b1 & 0x03) - 2;
+					} else if ((b1 & op_mask) == op_luma) {
+						uint8_t b2 = bytes[pos++];
+						int vg = (b1 & 0x3f) - 32;
+						pixel.R += vg - 8 + ((b2 >> 4) & 0x0f);
+						pixel.G += vg;
+						pixel.B += vg - 8 + (b2 & 0x0f);
+					} else {
+						run = b1 & 0x3f;
+					}
+					index[Hash(pixel)] = pixel;
+				}
+				row[x] = pixel;
+			}
+		}
+	}
+
+	void Write(std::ofstream& file) const override {
+		std::vector<uint8_t> bytes;
+		bytes.reserve(header_size + static_cast<std::size_t>(width) * height * (channels + 1) + sizeof(end_marker));
+		bytes.insert(bytes.end(), { 'q', 'o', 'i', 'f' });
+		WriteBigEndian(bytes, width);
+		WriteBigEndian(bytes, height);
+		bytes.push_back(channels);
+		bytes.push_back(0);
+		Pixel index[64] = {};
+		for (Pixel& pixel : index) {
+			pixel.A = 0;
+		}
+		Pixel previous;
+		int run = 0;
+		for (int line = 0; line < height; line++) {
+			const Pixel* row = GetFileRow(line, true);
+			for (int x = 0; x < width; x++) {
+				Pixel pixel = row[x];
+				if (channels == 3) {
+					pixel.A = 255;
+				}
+				if (Equal(pixel, previous)) {
+					run++;
+					if (run == 62) {
+						bytes.push_back(op_run | (run - 1));
+						run = 0;
+					}
+					continue;
+				}
+				if (run > 0) {
+					bytes.push_back(op_run | (run - 1));
+					run = 0;
+				}
+				int hash = Hash(pixel);
+				if (Equal(index[hash], pixel)) {
+					bytes.push_back(op_index | hash);
+				} else {
+					index[hash] = pixel;
+					if (pixel.A == previous.A) {
+						int8_t vr = static_cast<int8_t>(pixel.R - previous.R);
+						int8_t vg = static_cast<int8_t>(pixel.G - previous.G);
+						int8_t vb = static_cast<int8_t>(pixel.B - previous.B);
+						int vg_r = vr - vg;
+						int vg_b = vb - vg;
+						if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+							bytes.push_back(op_diff | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+						} else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+							bytes.push_back(op_luma | (vg + 32));
+							bytes.push_back((vg_r + 8) << 4 | (vg_b + 8));
+						} else {
+							bytes.insert(bytes.end(), { op_rgb, pixel.R, pixel.G, pixel.B });
+						}
+					} else {
+						bytes.insert(bytes.end(), { op_rgba, pixel.R, pixel.G, pixel.B, pixel.A });
+					}
+				}
+				previous = pixel;
+			}
+		}
+		if (run > 0) {
+			bytes.push_back(op_run | (run - 1));
+		}
+		bytes.insert(bytes.end(), std::begin(end_marker), std::end(end_marker));
+		file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	}
+
+	void SetAlphaChannel(bool keep) override {
+		channels = keep ? 4 : 3;
+	}
+
+private:
+	static constexpr std::size_t header_size = 14;
+	static constexpr uint8_t end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	static constexpr uint8_t op_index = 0x00;
+	static constexpr uint8_t op_diff = 0x40;
+	static constexpr uint8_t op_luma = 0x80;
+	static constexpr uint8_t op_run = 0xc0;
+	static constexpr uint8_t op_rgb = 0xfe;
+	static constexpr uint8_t op_rgba = 0xff;
+	static constexpr uint8_t op_mask = 0xc0;
+
+	uint8_t channels = 3;
+
+	static int Hash(const Pixel& pixel) {
+		return (pixel.R * 3 + pixel.G * 5 + pixel.B * 7 + pixel.A * 11) % 64;
+	}
+
+	static bool Equal(const Pixel& first, const Pixel& second) {
+		return first.B == second.B && first.G == second.G && first.R == second.R && first.A == second.A;
+	}
+
+	static uint32_t ReadBigEndian(const uint8_t* bytes) {
+		return static_cast<uint32_t>(bytes[0]) << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+	}
+
+	static void WriteBigEndian(std::vector<uint8_t>& bytes, uint32_t value) {
+		bytes.insert(bytes.end(), { static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value) });
+	}
+};
+
+
+// Upper bound for the worker threads of ForEachRowRange(), set by --threads; 0 means one per hardware thread.
+static int thread_limit = 0;
+
+static int GetThreadCount() {
+	return thread_limit > 0 ? thread_limit : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// Splits the rows [0, height) between the worker threads.
+static void ForEachRowRange(int height, const std::function<void(int, int)>& body) {
+	int threads = std::max(1, std::min(GetThreadCount(), height / 64));
+	if (threads == 1) {
+		body(0, height);
+		return;
+	}
+	std::vector<std::thread> workers;
+	for (int thread = 0; thread < threads; thread++) {
+		workers.emplace_back(body, height * thread / threads, height * (thread + 1) / threads);
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+
+// Luminance and per-channel histograms, gathered in one pass over the image. Every
+// thread fills its own copy and the copies are summed at the end.
+struct ImageStats {
+	using Histogram = std::array<uint64_t, 256>;
+
+	// Luminance as ContrastFilter measures it: B / 3 + G / 3 + R / 3.
+	Histogram luminance{};
+	Histogram blue{};
+	Histogram green{};
+	Histogram red{};
+	uint64_t count = 0;
+
+	static ImageStats Gather(Image& image) {
+		std::vector<ImageStats> partial(GetThreadCount());
+		std::mutex mutex;
+		std::size_t next = 0;
+		ForEachRowRange(image.GetHeight(), [&](int y_begin, int y_end) {
+			ImageStats* stats = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stats = &partial[next++];
+			}
+			for (int y = y_begin; y < y_end; y++) {
+				stats->Add(image.GetRow(y), image.GetWidth());
+			}
+		});
+		for (std::size_t index = 1; index < partial.size(); index++) {
+			partial[0].Merge(partial[index]);
+		}
+		return partial[0];
+	}
+
+	void Add(const Pixel* row, int width) {
+		for (int x = 0; x < width; x++) {
+			luminance[row[x].B / 3 + row[x].G / 3 + row[x].R / 3]++;
+			blue[row[x].B]++;
+			green[row[x].G]++;
+			red[row[x].R]++;
+		}
+		count += width;
+	}
+
+	void Merge(const ImageStats& other) {
+		for (int value = 0; value < 256; value++) {
+			luminance[value] += other.luminance[value];
+			blue[value] += other.blue[value];
+			green[value] += other.green[value];
+			red[value] += other.red[value];
+		}
+		count += other.count;
+	}
+
+	const Histogram& GetChannel(Channel channel) const {
+		switch (channel) {
+		case Channel::B: return blue;
+		case Channel::G: return green;
+		default: return red;
+		}
+	}
+
+	// The smallest value with more than `fraction` of the pixels at or below it;
+	// a fraction of 1 gives the largest value present.
+	uint8_t Percentile(const Histogram& histogram, double fraction) const {
+		double threshold = fraction * count;
+		uint64_t cumulative = 0;
+		for (int value = 0; value < 256; value++) {
+			cumulative += histogram[value];
+			if (cumulative > threshold || (fraction >= 1.0 && cumulative == count)) {
+				return value;
+			}
+		}
+		return 255;
+	}
+};
+
+
+// Applies a table-driven transform to every row of the image, split between threads.
+static void ApplyPointMap(Image& image, const PointMap& map) {
+	ForEachRowRange(image.GetHeight(), [&](int y_begin, int y_end) {
+		for (int y = y_begin; y < y_end; y++) {
+			Pixel* row = image.GetRow(y);
+			map.ApplyRow(row, row, image.GetWidth());
+		}
+	});
+}
+
+
+class DiscolorFilter : public Filter {
+public:
+	DiscolorFilter() = default;
+	std::size_t GetArity() const override {
+		return 0;
+	}
+	void SetArguments(std::size_t n, const std::string& arg) override {
+		if (n >= GetArity()) {
+			throw std::runtime_error("Error! Wromg number of arguments");
+		}
+		return;
+	}
+	void ApplyRow(const RowWindow& window, int y, Pixel* out) const override {
+		discolor(window.GetRow(y), out, window.GetWidth());
+	}
+	bool AppendPointMap(PointMap& map) const override {
+		map.AppendLuma();
+		return true;
+	}
+private:
+	static void discolor(const Pixel* row, Pixel* out, int width) {
+		for (int x = 0; x < width; x++) {
+			Pixel pixel = row[x];
+			uint8_t color = PointMap::Luma(pixel.B, pixel.G, pixel.R);
+			pixel.B = color;
+			pixel.G = color;
+			pixel.R = color;
+			out[x] = pixel;
+		}
+	}
+};
+
+
+class LightenFilter : public Filter {
+public:
+	std::size_t GetArity() const override {
+		return 1;
 	}
 	void SetArguments(std::size_t n, const std::string& arg) override {
 		if (n >= GetArity()) {
@@ -269,18 +1320,22 @@ public:
 		}
 		scale = std::stoi(arg);
 	}
-	void Apply(Image& image) const override {
-		lighten(image, scale);
+	void ApplyRow(const RowWindow& window, int y, Pixel* out) const override {
+		lighten(window.GetRow(y), out, window.GetWidth(), scale);
+	}
+	bool AppendPointMap(PointMap& map) const override {
+		map.AppendChannelMap([this](Channel, uint8_t value) { return std::min(255, value + scale); });
+		return true;
 	}
 private:
 	uint8_t scale = 0;
-	static void lighten(Image& image, uint8_t scale) {
-		for (std::size_t y = 0; y < image.GetHeight(); y++) {
-			for (std::size_t x = 0; x < image.GetWidth(); x++) {
-				image.GetPixel(y, x).B = std::min(255, image.GetPixel(y, x).B + scale); 
-				image.GetPixel(y, x).G = std::min(255, image.GetPixel(y, x).G + scale);
-				image.GetPixel(y, x).R = std::min(255, image.GetPixel(y, x).R + scale);
-			}
+	static void lighten(const Pixel* row, Pixel* out, int width, uint8_t scale) {
+		for (int x = 0; x < width; x++) {
+			Pixel pixel = row[x];
+			pixel.B = std::min(255, pixel.B + scale);
+			pixel.G = std::min(255, pixel.G + scale);
+			pixel.R = std::min(255, pixel.R + scale);
+			out[x] = pixel;
 		}
 	}
 };
@@ -297,18 +1352,22 @@ public:
 		}
 		scale = std::stoi(arg);
 	}
-	void Apply(Image& image) const override {
-		darken(image, scale);
+	void ApplyRow(const RowWindow& window, int y, Pixel* out) const override {
+		darken(window.GetRow(y), out, window.GetWidth(), scale);
+	}
+	bool AppendPointMap(PointMap& map) const override {
+		map.AppendChannelMap([this](Channel, uint8_t value) { return std::max(0, value - scale); });
+		return true;
 	}
 private:
 	uint8_t scale = 0;
-	static void darken(Image& image, uint8_t scale) {
-		for (std::size_t y = 0; y < image.GetHeight(); y++) {
-			for (std::size_t x = 0; x < image.GetWidth(); x++) {
-				image.GetPixel(y, x).B = std::max(0, image.GetPixel(y, x).B - scale); 
-				image.GetPixel(y, x).G = std::max(0, image.GetPixel(y, x).G - scale);
-				image.GetPixel(y, x).R = std::max(0, image.GetPixel(y, x).R - scale);
-			}
+	static void darken(const Pixel* row, Pixel* out, int width, uint8_t scale) {
+		for (int x = 0; x < width; x++) {
+			Pixel pixel = row[x];
+			pixel.B = std::max(0, pixel.B - scale);
+			pixel.G = std::max(0, pixel.G - scale);
+			pixel.R = std::max(0, pixel.R - scale);
+			out[x] = pixel;
 		}
 	}
 };
@@ -328,26 +1387,126 @@ public:
 	void Apply(Image& image) const override {
 		contrast(image);
 	}
+	bool IsStreamable() const override {
+		return false;
+	}
 private:
+	// Stretches the luminance range to [0, 255] and scales the channels of every pixel by
+	// new / old luminance. The scaled values come from a table indexed by (luminance, channel).
 	static void contrast(Image& image) {
-		uint8_t min_contrast = 255;
-		uint8_t max_contrast = 0;
-		for (std::size_t y = 0; y < image.GetHeight(); y++) {
-			for (std::size_t x = 0; x < image.GetWidth(); x++) {
-				uint8_t color = image.GetPixel(y, x).B / 3 + image.GetPixel(y, x).G / 3 + image.GetPixel(y, x).R / 3;
-				min_contrast = std::min(color, min_contrast); 
-				max_contrast = std::max(color, max_contrast);
-			}
-		}
-		for (std::size_t y = 0; y < image.GetHeight(); y++) {
-			for (std::size_t x = 0; x < image.GetWidth(); x++) {
-				uint8_t color = image.GetPixel(y, x).B / 3 + image.GetPixel(y, x).G / 3 + image.GetPixel(y, x).R / 3;
-				uint8_t new_color = 255 * (color - min_contrast) / (max_contrast - min_contrast);
-				if (color == 0 || new_color == 0)
-					continue;
-				image.GetPixel(y, x).B = image.GetPixel(y, x).B * new_color / color;
-				image.GetPixel(y, x).G = image.GetPixel(y, x).G * new_color / color;
-				image.GetPixel(y, x).R = image.GetPixel(y, x).R * new_color / color;
+		ImageStats stats = ImageStats::Gather(image);
+		int min_contrast = stats.Percentile(stats.luminance, 0.0);
+		int max_contrast = stats.Percentile(stats.luminance, 1.0);
+		if (max_contrast == min_contrast) {
+			return;
+		}
+		std::vector<uint8_t> scaled(256 * 256);
+		for (int color = 0; color < 256; color++) {
+			int new_color = color < min_contrast ? 0 : 255 * (color - min_contrast) / (max_contrast - min_contrast);
+			for (int value = 0; value < 256; value++) {
+				scaled[color * 256 + value] = (color == 0 || new_color == 0) ? value : std::min(255, value * new_color / color);
+			}
+		}
+		ForEachRowRange(image.GetHeight(), [&](int y_begin, int y_end) {
+			for (int y = y_begin; y < y_end; y++) {
+				Pixel* row = image.GetRow(y);
+				for (int x = 0; x < image.GetWidth(); x++) {
+					const uint8_t* table = scaled.data() + (row[x].B / 3 + row[x].G / 3 + row[x].R / 3) * 256;
+					row[x].B = table[row[x].B];
+					row[x].G = table[row[x].G];
+					row[x].R = table[row[x].R];
+				}
+			}
+		});
+	}
+};
+
+
+// Per-channel contrast stretch: the low and high percentiles of every channel are
+// mapped to 0 and 255, values outside them are clipped. "stretch 0 100" stretches
+// between the darkest and the brightest value.
+class StretchFilter : public Filter {
+public:
+	std::size_t GetArity() const override {
+		return 2;
+	}
+	void SetArguments(std::size_t n, const std::string& arg) override {
+		if (n >= GetArity()) {
+			throw std::runtime_error("Error! Wromg number of arguments");
+		}
+		double percent = std::stod(arg);
+		if (percent < 0 || percent > 100) {
+			throw std::runtime_error("Error! Invalid argument!");
+		}
+		(n == 0 ? low : high) = percent / 100;
+	}
+	void Apply(Image& image) const override {
+		ImageStats stats = ImageStats::Gather(image);
+		int low_values[3];
+		int high_values[3];
+		for (Channel channel : { Channel::R, Channel::G, Channel::B }) {
+			low_values[static_cast<int>(channel)] = stats.Percentile(stats.GetChannel(channel), low);
+			high_values[static_cast<int>(channel)] = stats.Percentile(stats.GetChannel(channel), high);
+		}
+		PointMap map;
+		map.AppendChannelMap([&](Channel channel, uint8_t value) {
+			int low_value = low_values[static_cast<int>(channel)];
+			int high_value = high_values[static_cast<int>(channel)];
+			if (high_value <= low_value) {
+				return value;
+			}
+			int stretched = (2 * 255 * (value - low_value) + (high_value - low_value)) / (2 * (high_value - low_value));
+			return static_cast<uint8_t>(std::clamp(stretched, 0, 255));
+		});
+		ApplyPointMap(image, map);
+	}
+	bool IsStreamable() const override {
+		return false;
+	}
+private:
+	double low = 0;
+	double high = 1;
+};
+
+
+// Per-channel histogram equalization: every value is mapped through the cumulative
+// distribution of its channel.
+class EqualizeFilter : public Filter {
+public:
+	std::size_t GetArity() const override {
+		return 0;
+	}
+	void SetArguments(std::size_t n, const std::string&) override {
+		if (n >= GetArity()) {
+			throw std::runtime_error("Error! Wromg number of arguments");
+		}
+	}
+	void Apply(Image& image) const override {
+		ImageStats stats = ImageStats::Gather(image);
+		uint8_t tables[3][256];
+		for (Channel channel : { Channel::R, Channel::G, Channel::B }) {
+			BuildTable(stats.GetChannel(channel), stats.count, tables[static_cast<int>(channel)]);
+		}
+		PointMap map;
+		map.AppendChannelMap([&](Channel channel, uint8_t value) { return tables[static_cast<int>(channel)][value]; });
+		ApplyPointMap(image, map);
+	}
+	bool IsStreamable() const override {
+		return false;
+	}
+private:
+	static void BuildTable(const ImageStats::Histogram& histogram, uint64_t count, uint8_t* table) {
+		uint64_t cumulative = 0;
+		uint64_t first = 0;
+		for (int value = 0; value < 256; value++) {
+			cumulative += histogram[value];
+			if (first == 0) {
+				first = cumulative;
+			}
+			if (count == first) {
+				table[value] = value;
+			} else {
+				table[value] = cumulative < first ? 0 : ((cumulative - first) * 255 + (count - first) / 2) / (count - first);
 			}
 		}
 	}
@@ -370,17 +1529,23 @@ public:
 			filter = InterpretArg(arg);
 		}
 	}
-	void Apply(Image& image) const override {
-		Colorize(image, scale, filter);
+	void ApplyRow(const RowWindow& window, int y, Pixel* out) const override {
+		Colorize(window.GetRow(y), out, window.GetWidth(), scale, filter);
+	}
+	bool AppendPointMap(PointMap& map) const override {
+		map.AppendChannelMap([this](Channel channel, uint8_t value) {
+			return channel == filter ? std::min(255, value + scale) : value;
+		});
+		return true;
 	}
 private:
 	uint8_t scale = 0;
 	Channel filter = Channel::B;
-	static void Colorize(Image& image, uint8_t scale, Channel filter) {
-		for (std::size_t y = 0; y < image.GetHeight(); y++) {
-			for (std::size_t x = 0; x < image.GetWidth(); x++) {
-				image.GetPixel(y, x).GetChannel(filter) = std::min(255, image.GetPixel(y, x).GetChannel(filter) + scale); // Naosareta
-			}
+	static void Colorize(const Pixel* row, Pixel* out, int width, uint8_t scale, Channel filter) {
+		for (int x = 0; x < width; x++) {
+			Pixel pixel = row[x];
+			pixel.GetChannel(filter) = std::min(255, pixel.GetChannel(filter) + scale); // Naosareta
+			out[x] = pixel;
 		}
 	}
 	static Channel InterpretArg(std::string arg) {
@@ -411,83 +1576,1305 @@ public:
 		}
 		scale = std::stoi(arg);
 	}
-	void Apply(Image& image) const override {
-		blur(image, scale);
+	int GetRadius() const override {
+		return scale;
+	}
+	void ApplyRow(const RowWindow& window, int y, Pixel* out) const override {
+		blur(window, y, out, scale);
 	}
 private:
 	uint8_t scale = 0;
-	void blur(Image& image, uint8_t scale) const {
-		for (int y = 0; y < image.GetHeight(); y++) {
-			for (int x = 0; x < image.GetWidth(); x++) {
-				int neighbourBsum = 0;
-				int neighboursB = 0;
-				int neighbourGsum = 0;
-				int neighboursG = 0;
-				int neighbourRsum = 0;
-				int neighboursR = 0;
-				for (int ny = std::max(y - scale, 0); ny < std::min(image.GetHeight(), y + scale); ny++) {
-					for (int nx = std::max(x - scale, 0); nx < std::min(image.GetWidth(), x + scale); nx++) {
-						neighbourBsum += image.GetPixel(ny, nx).B; neighboursB++;
-						neighbourGsum += image.GetPixel(ny, nx).G; neighboursG++;
-						neighbourRsum += image.GetPixel(ny, nx).R; neighboursR++;
-					}
-				}
-				image.GetPixel(y, x).B = neighbourBsum / neighboursB;
-				image.GetPixel(y, x).G = neighbourGsum / neighboursG;
-				image.GetPixel(y, x).R = neighbourRsum / neighboursR;
+	// Box blur over the (2 * scale + 1) square clipped to the image: the vertical sums are
+	// gathered once per column, then slid along the row.
+	static void blur(const RowWindow& window, int y, Pixel* out, int scale) {
+		int width = window.GetWidth();
+		int y_begin = std::max(y - scale, 0);
+		int y_end = std::min(window.GetHeight(), y + scale + 1);
+		std::vector<int> column_sums(width * 3, 0);
+		for (int ny = y_begin; ny < y_end; ny++) {
+			const Pixel* row = window.GetRow(ny);
+			for (int x = 0; x < width; x++) {
+				column_sums[x * 3] += row[x].B;
+				column_sums[x * 3 + 1] += row[x].G;
+				column_sums[x * 3 + 2] += row[x].R;
+			}
+		}
+		const Pixel* row = window.GetRow(y);
+		int neighbourBsum = 0;
+		int neighbourGsum = 0;
+		int neighbourRsum = 0;
+		int x_begin = 0;
+		int x_end = 0;
+		for (int x = 0; x < width; x++) {
+			for (; x_end < std::min(width, x + scale + 1); x_end++) {
+				neighbourBsum += column_sums[x_end * 3];
+				neighbourGsum += column_sums[x_end * 3 + 1];
+				neighbourRsum += column_sums[x_end * 3 + 2];
 			}
+			for (; x_begin < x - scale; x_begin++) {
+				neighbourBsum -= column_sums[x_begin * 3];
+				neighbourGsum -= column_sums[x_begin * 3 + 1];
+				neighbourRsum -= column_sums[x_begin * 3 + 2];
+			}
+			int neighbours = (x_end - x_begin) * (y_end - y_begin);
+			out[x].B = neighbourBsum / neighbours;
+			out[x].G = neighbourGsum / neighbours;
+			out[x].R = neighbourRsum / neighbours;
+			out[x].A = row[x].A;
 		}
 	}
 };
 
-int main(int argc, char** argv) {
-	std::unordered_map<std::string, std::function<std::unique_ptr<Filter>()>> filters // Naosareta
-	{
-		{ "discolor", []() -> std::unique_ptr<Filter> { return std::make_unique<DiscolorFilter>(); } },
-		{ "lighten", []() -> std::unique_ptr<Filter> { return std::make_unique<LightenFilter>(); } },
-		{ "darken", []() -> std::unique_ptr<Filter> { return std::make_unique<DarkenFilter>(); } },
-		{ "colorize", []() -> std::unique_ptr<Filter> { return std::make_unique<ColorFilter>(); } },
-		{ "contrast", []() -> std::unique_ptr<Filter> { return std::make_unique<ContrastFilter>(); } },
-		{ "blur", []() -> std::unique_ptr<Filter> { return std::make_unique<BlurFilter>(); } }
-	};
-	BMP bmp;
-	std::ifstream fin;
-	int arg_pos = 1;
+enum class ResampleMode { nearest, bilinear, lanczos };
+
+
+// Precomputed weights of one resampling axis: destination index d reads `taps` source
+// indices starting at first[d], weighted by weights[d * taps + k] in 2.14 fixed point.
+struct ResampleWeights {
+	int taps = 0;
+	std::vector<int> first;
+	std::vector<int16_t> weights;
+
+	static const int precision = 14;
+
+	ResampleWeights(int src_size, int dst_size, ResampleMode mode) : first(dst_size) {
+		double scale = static_cast<double>(src_size) / dst_size;
+		// When shrinking, the kernel is stretched over the source so that every source pixel contributes.
+		double filter_scale = std::max(scale, 1.0);
+		double support = (mode == ResampleMode::lanczos ? 3.0 : 1.0) * filter_scale;
+		std::vector<std::vector<double>> contributions(dst_size);
+		std::vector<int> begins(dst_size);
+		for (int d = 0; d < dst_size; d++) {
+			double center = (d + 0.5) * scale;
+			if (mode == ResampleMode::nearest) {
+				begins[d] = std::min(src_size - 1, static_cast<int>(center));
+				contributions[d].push_back(1.0);
+				continue;
+			}
+			int begin = std::max(0, static_cast<int>(center - support + 0.5));
+			int end = std::min(src_size, static_cast<int>(center + support + 0.5));
+			begins[d] = begin;
+			double total = 0;
+			for (int s = begin; s < end; s++) {
+				double weight = Kernel((s - center + 0.5) / filter_scale, mode);
+				contributions[d].push_back(weight);
+				total += weight;
+			}
+			for (double& weight : contributions[d]) {
+				weight = total != 0 ? weight / total : 0;
+			}
+			taps = std::max(taps, end - begin);
+		}
+		taps = std::max(taps, 1);
+		weights.assign(static_cast<std::size_t>(dst_size) * taps, 0);
+		for (int d = 0; d < dst_size; d++) {
+			first[d] = std::max(0, std::min(begins[d], src_size - taps));
+			int16_t* row = weights.data() + static_cast<std::size_t>(d) * taps;
+			int sum = 0;
+			int largest = begins[d] - first[d];
+			for (std::size_t k = 0; k < contributions[d].size(); k++) {
+				int16_t weight = static_cast<int16_t>(std::lround(contributions[d][k] * (1 << precision)));
+				row[begins[d] - first[d] + k] = weight;
+				sum += weight;
+				if (weight > row[largest]) {
+					largest = begins[d] - first[d] + k;
+				}
+			}
+			// Rounding must not change the overall brightness.
+			row[largest] += (1 << precision) - sum;
+		}
+	}
+
+	static double Kernel(double t, ResampleMode mode) {
+		t = std::abs(t);
+		if (mode == ResampleMode::bilinear) {
+			return std::max(0.0, 1.0 - t);
+		}
+		if (t == 0) {
+			return 1.0;
+		}
+		if (t >= 3.0) {
+			return 0.0;
+		}
+		const double pi = 3.14159265358979323846;
+		return 3.0 * std::sin(pi * t) * std::sin(pi * t / 3.0) / (pi * pi * t * t);
+	}
+};
+
+
+// Separable two-pass resampling on rows: every incoming row is resampled horizontally
+// into a ring of `taps` rows, and every output row is blended from the ring as soon as
+// its last source row has arrived.
+class ResampleStage : public RowStage {
+public:
+	ResampleStage(int width, int height, int new_width, int new_height, ResampleMode mode) :
+		RowStage(new_width, new_height), input_width(width), horizontal(width, new_width, mode), vertical(height, new_height, mode),
+		ring(static_cast<std::size_t>(new_width) * vertical.taps), out(new_width), sums(static_cast<std::size_t>(new_width) * 4) {}
+
+	void Push(int y, Pixel* row) override {
+		ResampleRow(row, GetRingRow(y));
+		for (; next_row < output_height && vertical.first[next_row] + vertical.taps - 1 <= y; next_row++) {
+			BlendRows(next_row);
+		}
+	}
+
+private:
+	int input_width;
+	ResampleWeights horizontal;
+	ResampleWeights vertical;
+	std::vector<Pixel> ring;
+	std::vector<Pixel> out;
+	std::vector<int32_t> sums;
+	int next_row = 0;
+
+	Pixel* GetRingRow(int y) {
+		return ring.data() + static_cast<std::size_t>(y % vertical.taps) * output_width;
+	}
+
+	void ResampleRow(const Pixel* row, Pixel* target) const {
+		const int taps = horizontal.taps;
+		for (int x = 0; x < output_width; x++) {
+			const Pixel* source = row + horizontal.first[x];
+			const int16_t* weights = horizontal.weights.data() + static_cast<std::size_t>(x) * taps;
+#ifdef __SSE2__
+			// Two source pixels per step: their channels are interleaved (B0 B1 G0 G1 ...) so
+			// that madd multiplies both by their weights and adds them in one instruction.
+			const __m128i zero = _mm_setzero_si128();
+			__m128i acc = _mm_set1_epi32(1 << (ResampleWeights::precision - 1));
+			int k = 0;
+			for (; k + 1 < taps; k += 2) {
+				__m128i pair = _mm_unpacklo_epi8(_mm_unpacklo_epi8(LoadPixel(source + k), LoadPixel(source + k + 1)), zero);
+				__m128i weight = _mm_set1_epi32(static_cast<uint16_t>(weights[k]) | (static_cast<uint32_t>(static_cast<uint16_t>(weights[k + 1])) << 16));
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(pair, weight));
+			}
+			if (k < taps) {
+				__m128i single = _mm_unpacklo_epi8(_mm_unpacklo_epi8(LoadPixel(source + k), zero), zero);
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(single, _mm_set1_epi32(static_cast<uint16_t>(weights[k]))));
+			}
+			__m128i result = _mm_srai_epi32(acc, ResampleWeights::precision);
+			result = _mm_packs_epi32(result, result);
+			result = _mm_packus_epi16(result, result);
+			uint32_t packed = static_cast<uint32_t>(_mm_cvtsi128_si32(result));
+			std::memcpy(reinterpret_cast<uint8_t*>(target + x), &packed, sizeof(Pixel));
+#else
+			int32_t b = 1 << (ResampleWeights::precision - 1), g = b, r = b, a = b;
+			for (int k = 0; k < taps; k++) {
+				b += weights[k] * source[k].B;
+				g += weights[k] * source[k].G;
+				r += weights[k] * source[k].R;
+				a += weights[k] * source[k].A;
+			}
+			target[x].B = Clamp(b >> ResampleWeights::precision);
+			target[x].G = Clamp(g >> ResampleWeights::precision);
+			target[x].R = Clamp(r >> ResampleWeights::precision);
+			target[x].A = Clamp(a >> ResampleWeights::precision);
+#endif
+		}
+	}
+
+	void BlendRows(int y) {
+		const int16_t* weights = vertical.weights.data() + static_cast<std::size_t>(y) * vertical.taps;
+		std::fill(sums.begin(), sums.end(), 1 << (ResampleWeights::precision - 1));
+		for (int k = 0; k < vertical.taps; k++) {
+			const uint8_t* source = reinterpret_cast<const uint8_t*>(GetRingRow(vertical.first[y] + k));
+			int32_t weight = weights[k];
+			for (std::size_t index = 0; index < sums.size(); index++) {
+				sums[index] += weight * source[index];
+			}
+		}
+		uint8_t* target = reinterpret_cast<uint8_t*>(out.data());
+		for (std::size_t index = 0; index < sums.size(); index++) {
+			target[index] = Clamp(sums[index] >> ResampleWeights::precision);
+		}
+		sink(y, out.data());
+	}
+
+	static uint8_t Clamp(int32_t value) {
+		return static_cast<uint8_t>(std::min(255, std::max(0, value)));
+	}
+
+#ifdef __SSE2__
+	static __m128i LoadPixel(const Pixel* pixel) {
+		int32_t value;
+		std::memcpy(&value, pixel, sizeof(Pixel));
+		return _mm_cvtsi32_si128(value);
+	}
+#endif
+};
+
+
+class ResizeFilter : public Filter {
+public:
+	std::size_t GetArity() const override {
+		return 3;
+	}
+	void SetArguments(std::size_t n, const std::string& arg) override {
+		if (n >= GetArity()) {
+			throw std::runtime_error("Error! Wromg number of arguments");
+		}
+		if (n == 2) {
+			mode = InterpretArg(arg);
+			return;
+		}
+		int size = std::stoi(arg);
+		if (size <= 0) {
+			throw std::runtime_error("Error! Invalid argument!");
+		}
+		(n == 0 ? width : height) = size;
+	}
+	std::unique_ptr<RowStage> MakeStage(int image_width, int image_height) const override {
+		return std::make_unique<ResampleStage>(image_width, image_height, width, height, mode);
+	}
+private:
+	int width = 1;
+	int height = 1;
+	ResampleMode mode = ResampleMode::bilinear;
+	static ResampleMode InterpretArg(const std::string& arg) {
+		if (arg == "nearest") {
+			return ResampleMode::nearest;
+		}
+		else if (arg == "bilinear") {
+			return ResampleMode::bilinear;
+		}
+		else if (arg == "lanczos") {
+			return ResampleMode::lanczos;
+		}
+		else {
+			throw std::runtime_error("Error! Invalid argument!");
+		}
+	}
+};
+
+
+// Grey-level erosion (minimum) or dilation (maximum) over the (2r+1) square clipped to the
+// image, channel by channel; the alpha channel is kept from the centre pixel. The square is split into a horizontal and a vertical pass, both
+// using van Herk/Gil-Werman: the line is cut into blocks of 2r+1, and every window is the
+// combination of one block suffix and the next block prefix, i.e. three operations per pixel
+// whatever the radius. Outside the image the line is padded with the identity of the operation.
+class MorphologyStage : public RowStage {
+public:
+	MorphologyStage(int width, int height, int radius, bool maximum) : RowStage(width, height), radius(radius), size(2 * radius + 1), maximum(maximum),
+		identity(width, maximum ? Pixel{ 0, 0, 0, 0 } : Pixel{ 255, 255, 255, 255 }), block(static_cast<std::size_t>(size) * width), prefix(width), out(width),
+		line((width + 2 * radius + size - 1) / size * size, identity[0]), line_prefix(line.size()), line_suffix(line.size()) {
+		for (int y = 0; y < radius; y++) {
+			PushPadded(identity.data());
+		}
+	}
+
+	void Push(int, Pixel* row) override {
+		FilterLine(row);
+		PushPadded(row);
+	}
+
+	void Finish() override {
+		for (int y = 0; y < radius; y++) {
+			PushPadded(identity.data());
+		}
+	}
+
+private:
+	int radius;
+	int size;
+	bool maximum;
+	std::vector<Pixel> identity;
+	// Rows of the current block; once the block is complete they are replaced by its suffixes.
+	std::vector<Pixel> block;
+	std::vector<Pixel> prefix;
+	std::vector<Pixel> out;
+	std::vector<Pixel> line;
+	std::vector<Pixel> line_prefix;
+	std::vector<Pixel> line_suffix;
+	// Index of the next row counting the padding rows above the image.
+	int next_row = 0;
+
+	static_assert(sizeof(Pixel) == 4, "rows are combined byte by byte");
+
+	// Both combinations take the alpha channel from a.
+	Pixel Combine(Pixel a, Pixel b) const {
+		auto pick = [this](uint8_t x, uint8_t y) { return maximum ? std::max(x, y) : std::min(x, y); };
+		return Pixel{ pick(a.B, b.B), pick(a.G, b.G), pick(a.R, b.R), a.A };
+	}
+
+	void CombineRows(const Pixel* a, const Pixel* b, Pixel* target) const {
+		const uint8_t* left = reinterpret_cast<const uint8_t*>(a);
+		const uint8_t* right = reinterpret_cast<const uint8_t*>(b);
+		uint8_t* result = reinterpret_cast<uint8_t*>(target);
+		std::size_t count = static_cast<std::size_t>(output_width) * sizeof(Pixel);
+		std::size_t index = 0;
+#ifdef __SSE2__
+		const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+		for (; index + 16 <= count; index += 16) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + index));
+			__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + index));
+			__m128i picked = maximum ? _mm_max_epu8(x, y) : _mm_min_epu8(x, y);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(result + index), _mm_or_si128(_mm_andnot_si128(alpha, picked), _mm_and_si128(alpha, x)));
+		}
+#endif
+		for (; index < count; index++) {
+			bool is_alpha = index % sizeof(Pixel) == 3;
+			result[index] = is_alpha ? left[index] : maximum ? std::max(left[index], right[index]) : std::min(left[index], right[index]);
+		}
+	}
+
+	void FilterLine(Pixel* row) {
+		std::copy(row, row + output_width, line.begin() + radius);
+		for (std::size_t i = 0; i < line.size(); i++) {
+			line_prefix[i] = i % size == 0 ? line[i] : Combine(line_prefix[i - 1], line[i]);
+		}
+		for (std::size_t i = line.size(); i-- > 0;) {
+			line_suffix[i] = i % size == static_cast<std::size_t>(size - 1) ? line[i] : Combine(line[i], line_suffix[i + 1]);
+		}
+		for (int x = 0; x < output_width; x++) {
+			row[x] = Combine(row[x], Combine(line_suffix[x], line_prefix[x + 2 * radius]));
+		}
+	}
+
+	// The same scheme down the columns: prefix holds the running prefix of the current block,
+	// and row y is produced once the row 2r below it (in padded numbering) has arrived. Its centre
+	// row r below it is still in block, either as stored or as the first row of a suffix, and
+	// in both cases with its own alpha.
+	void PushPadded(const Pixel* row) {
+		int slot = next_row % size;
+		Pixel* stored = block.data() + static_cast<std::size_t>(slot) * output_width;
+		std::copy(row, row + output_width, stored);
+		if (slot == 0) {
+			std::copy(row, row + output_width, prefix.begin());
+		} else {
+			CombineRows(prefix.data(), row, prefix.data());
+		}
+		if (slot == size - 1) {
+			for (int s = size - 2; s >= 0; s--) {
+				Pixel* current = block.data() + static_cast<std::size_t>(s) * output_width;
+				CombineRows(current, current + output_width, current);
+			}
+		}
+		if (next_row >= 2 * radius) {
+			int y = next_row - 2 * radius;
+			CombineRows(block.data() + static_cast<std::size_t>(y % size) * output_width, prefix.data(), out.data());
+			CombineRows(block.data() + static_cast<std::size_t>((y + radius) % size) * output_width, out.data(), out.data());
+			sink(y, out.data());
+		}
+		next_row++;
+	}
+};
+
+
+// Median over the (2r+1) square clipped to the image (the lower one for an even count), after
+// Perreault and Hebert: every column keeps a histogram of its 2r+1 rows, and the window histogram
+// slides along the row by adding one column and removing another. Histograms are split into 16
+// coarse bins of 16 fine ones; the coarse part of the window is kept up to date, a fine segment is
+// only brought up to date when the median falls into it.
+class MedianStage : public RowStage {
+public:
+	MedianStage(int width, int height, int radius) : RowStage(width, height), radius(radius),
+		ring(static_cast<std::size_t>(width) * (2 * radius + 1)), out(width),
+		column_fine(static_cast<std::size_t>(width) * 3 * 256), column_coarse(static_cast<std::size_t>(width) * 3 * 16) {}
+
+	void Push(int y, Pixel* row) override {
+		std::copy(row, row + output_width, GetWindow().GetRow(y));
+		UpdateColumns(y, 1);
+		if (y >= radius) {
+			Produce(y - radius);
+		}
+	}
+
+	void Finish() override {
+		for (int y = std::max(0, output_height - radius); y < output_height; y++) {
+			Produce(y);
+		}
+	}
+
+private:
+	// The window histogram of one channel; segment s of fine covers the columns [segment_begin[s], segment_end[s]).
+	struct Kernel {
+		uint32_t coarse[16];
+		uint32_t fine[256];
+		int segment_begin[16];
+		int segment_end[16];
+	};
+
+	int radius;
+	std::vector<Pixel> ring;
+	std::vector<Pixel> out;
+	std::vector<uint16_t> column_fine;
+	std::vector<uint16_t> column_coarse;
+	Kernel kernels[3];
+
+	RowWindow GetWindow() {
+		return RowWindow(ring.data(), output_width, output_height, 2 * radius + 1);
+	}
+
+	void UpdateColumns(int y, int delta) {
+		const Pixel* row = GetWindow().GetRow(y);
+		for (int x = 0; x < output_width; x++) {
+			const uint8_t values[3] = { row[x].B, row[x].G, row[x].R };
+			for (int c = 0; c < 3; c++) {
+				std::size_t column = static_cast<std::size_t>(x) * 3 + c;
+				column_fine[column * 256 + values[c]] += delta;
+				column_coarse[column * 16 + (values[c] >> 4)] += delta;
+			}
+		}
+	}
+
+	void AddColumn(Kernel& kernel, int c, int x, int delta) const {
+		const uint16_t* coarse = column_coarse.data() + (static_cast<std::size_t>(x) * 3 + c) * 16;
+		for (int bin = 0; bin < 16; bin++) {
+			kernel.coarse[bin] += delta * coarse[bin];
+		}
+	}
+
+	void AddSegment(Kernel& kernel, int c, int segment, int x, int delta) const {
+		const uint16_t* fine = column_fine.data() + (static_cast<std::size_t>(x) * 3 + c) * 256 + segment * 16;
+		for (int bin = 0; bin < 16; bin++) {
+			kernel.fine[segment * 16 + bin] += delta * fine[bin];
+		}
+	}
+
+	// Moves fine segment s to the columns [begin, end); both ends only ever move right.
+	void SyncSegment(Kernel& kernel, int c, int segment, int begin, int end) const {
+		if (kernel.segment_end[segment] <= begin) {
+			std::fill(kernel.fine + segment * 16, kernel.fine + segment * 16 + 16, 0);
+			kernel.segment_begin[segment] = kernel.segment_end[segment] = begin;
+		}
+		for (int x = kernel.segment_begin[segment]; x < begin; x++) {
+			AddSegment(kernel, c, segment, x, -1);
+		}
+		for (int x = kernel.segment_end[segment]; x < end; x++) {
+			AddSegment(kernel, c, segment, x, 1);
+		}
+		kernel.segment_begin[segment] = begin;
+		kernel.segment_end[segment] = end;
+	}
+
+	uint8_t FindMedian(Kernel& kernel, int c, int begin, int end, uint32_t rank) const {
+		uint32_t below = 0;
+		int segment = 0;
+		while (below + kernel.coarse[segment] <= rank) {
+			below += kernel.coarse[segment];
+			segment++;
+		}
+		SyncSegment(kernel, c, segment, begin, end);
+		int bin = segment * 16;
+		while (below + kernel.fine[bin] <= rank) {
+			below += kernel.fine[bin];
+			bin++;
+		}
+		return static_cast<uint8_t>(bin);
+	}
+
+	void Produce(int y) {
+		uint32_t rows = std::min(output_height - 1, y + radius) - std::max(0, y - radius) + 1;
+		for (int c = 0; c < 3; c++) {
+			Kernel& kernel = kernels[c];
+			std::fill(std::begin(kernel.coarse), std::end(kernel.coarse), 0);
+			std::fill(std::begin(kernel.segment_begin), std::end(kernel.segment_begin), 0);
+			std::fill(std::begin(kernel.segment_end), std::end(kernel.segment_end), 0);
+			for (int x = 0; x < std::min(output_width, radius + 1); x++) {
+				AddColumn(kernel, c, x, 1);
+			}
+		}
+		const Pixel* row = GetWindow().GetRow(y);
+		for (int x = 0; x < output_width; x++) {
+			int begin = std::max(0, x - radius);
+			int end = std::min(output_width, x + radius + 1);
+			if (x > 0) {
+				for (int c = 0; c < 3; c++) {
+					if (x + radius < output_width) {
+						AddColumn(kernels[c], c, x + radius, 1);
+					}
+					if (x - radius - 1 >= 0) {
+						AddColumn(kernels[c], c, x - radius - 1, -1);
+					}
+				}
+			}
+			uint32_t rank = ((end - begin) * rows - 1) / 2;
+			out[x].B = FindMedian(kernels[0], 0, begin, end, rank);
+			out[x].G = FindMedian(kernels[1], 1, begin, end, rank);
+			out[x].R = FindMedian(kernels[2], 2, begin, end, rank);
+			out[x].A = row[x].A;
+		}
+		sink(y, out.data());
+		if (y - radius >= 0) {
+			UpdateColumns(y - radius, -1);
+		}
+	}
+};
+
+
+class MedianFilter : public Filter {
+public:
+	std::size_t GetArity() const override {
+		return 1;
+	}
+	void SetArguments(std::size_t n, const std::string& arg) override {
+		if (n >= GetArity()) {
+			throw std::runtime_error("Error! Wromg number of arguments");
+		}
+		radius = std::stoi(arg);
+		if (radius < 0) {
+			throw std::runtime_error("Error! Invalid argument!");
+		}
+	}
+	int GetRadius() const override {
+		return radius;
+	}
+	std::unique_ptr<RowStage> MakeStage(int width, int height) const override {
+		return std::make_unique<MedianStage>(width, height, radius);
+	}
+private:
+	int radius = 0;
+};
+
+
+class MorphologyFilter : public Filter {
+public:
+	explicit MorphologyFilter(bool maximum) : maximum(maximum) {}
+	std::size_t GetArity() const override {
+		return 1;
+	}
+	void SetArguments(std::size_t n, const std::string& arg) override {
+		if (n >= GetArity()) {
+			throw std::runtime_error("Error! Wromg number of arguments");
+		}
+		radius = std::stoi(arg);
+		if (radius < 0) {
+			throw std::runtime_error("Error! Invalid argument!");
+		}
+	}
+	int GetRadius() const override {
+		return radius;
+	}
+	std::unique_ptr<RowStage> MakeStage(int width, int height) const override {
+		return std::make_unique<MorphologyStage>(width, height, radius, maximum);
+	}
+private:
+	bool maximum;
+	int radius = 0;
+};
+
+
+// The compiled form of a run of point-wise filters.
+class PointMapFilter : public Filter {
+public:
+	std::size_t GetArity() const override {
+		return 0;
+	}
+	void SetArguments(std::size_t, const std::string&) override {
+		throw std::runtime_error("Error! Wromg number of arguments");
+	}
+	void ApplyRow(const RowWindow& window, int y, Pixel* out) const override {
+		map.ApplyRow(window.GetRow(y), out, window.GetWidth());
+	}
+	bool AppendPointMap(PointMap&) const override {
+		return false;
+	}
+	PointMap map;
+};
+
+
+// Replaces every run of point-wise filters with a single PointMapFilter. The
+// compiled filters are owned by `compiled`. If given, `names` holds one name per
+// filter and is rewritten to match the result ("lighten+discolor" for a fused run).
+static std::vector<const Filter*> CompileFilters(const std::vector<const Filter*>& filters, std::vector<std::unique_ptr<Filter>>& compiled, std::vector<std::string>* names = nullptr) {
+	std::vector<const Filter*> result;
+	std::vector<std::string> result_names;
+	PointMapFilter* current = nullptr;
+	for (std::size_t index = 0; index < filters.size(); index++) {
+		const Filter* filter = filters[index];
+		std::string name = names != nullptr ? (*names)[index] : std::string();
+		PointMap map = current != nullptr ? current->map : PointMap();
+		if (!filter->AppendPointMap(map)) {
+			current = nullptr;
+			result.push_back(filter);
+			result_names.push_back(name);
+			continue;
+		}
+		if (current == nullptr) {
+			compiled.push_back(std::make_unique<PointMapFilter>());
+			current = static_cast<PointMapFilter*>(compiled.back().get());
+			result.push_back(current);
+			result_names.push_back(name);
+		} else {
+			result_names.back() += "+" + name;
+		}
+		current->map = map;
+	}
+	if (names != nullptr) {
+		*names = result_names;
+	}
+	return result;
+}
+
+
+// Wall time and throughput per stage for --profile. Stages running on different
+// threads may overlap, so their times can add up to more than the total.
+class Profiler {
+public:
+	explicit Profiler(bool enabled) : enabled(enabled), start(std::chrono::steady_clock::now()) {}
+
+	// Runs body, which returns the number of pixels it processed, and adds its time to the stage.
+	template <class Body>
+	void Measure(const std::string& stage, Body&& body) {
+		if (!enabled) {
+			body();
+			return;
+		}
+		auto begin = std::chrono::steady_clock::now();
+		uint64_t pixels = body();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+		std::lock_guard<std::mutex> lock(mutex);
+		if (stages.count(stage) == 0) {
+			order.push_back(stage);
+		}
+		stages[stage].seconds += elapsed.count();
+		stages[stage].pixels += pixels;
+	}
+
+	void Report(std::ostream& out) const {
+		if (!enabled) {
+			return;
+		}
+		std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+		for (const std::string& stage : order) {
+			const Stage& entry = stages.at(stage);
+			PrintLine(out, stage, entry.seconds, entry.pixels);
+		}
+		PrintLine(out, "total", total.count(), 0);
+		double peak = GetPeakMemory();
+		if (peak > 0) {
+			out << "peak memory: " << peak / (1 << 20) << " MB\n";
+		}
+	}
+
+	// Peak resident set size in bytes, 0 where the platform does not tell.
+	static double GetPeakMemory() {
+#ifdef REDACTOR_HAS_MMAP
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+			return static_cast<double>(usage.ru_maxrss);
+#else
+			return static_cast<double>(usage.ru_maxrss) * 1024;
+#endif
+		}
+#endif
+		return 0;
+	}
+
+private:
+	struct Stage {
+		double seconds = 0;
+		uint64_t pixels = 0;
+	};
+
+	bool enabled;
+	std::chrono::steady_clock::time_point start;
+	std::mutex mutex;
+	std::vector<std::string> order;
+	std::map<std::string, Stage> stages;
+
+	static void PrintLine(std::ostream& out, const std::string& stage, double seconds, uint64_t pixels) {
+		out << stage << ": " << seconds * 1000 << " ms";
+		if (pixels > 0 && seconds > 0) {
+			out << ", " << pixels / seconds / 1e6 << " MPix/s";
+		}
+		out << '\n';
+	}
+};
+
+
+static uint64_t GetPixelCount(Image& image) {
+	return static_cast<uint64_t>(image.GetWidth()) * image.GetHeight();
+}
+
+enum class ImageFormat { bmp, pgm, ppm, tga, qoi };
+
+
+// Recognizes the format by the magic bytes at the start of the file. TGA has no magic,
+// so a header that describes an uncompressed TGA image is taken as one.
+static ImageFormat DetectFormat(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Error! Unable to open the file");
+	}
+	uint8_t magic[sizeof(TGAHeader)] = {};
+	file.read(reinterpret_cast<char*>(magic), sizeof(magic));
+	if (magic[0] == 'B' && magic[1] == 'M') {
+		return ImageFormat::bmp;
+	}
+	if (magic[0] == 'P' && magic[1] == '5') {
+		return ImageFormat::pgm;
+	}
+	if (magic[0] == 'P' && magic[1] == '6') {
+		return ImageFormat::ppm;
+	}
+	if (std::memcmp(magic, "qoif", 4) == 0) {
+		return ImageFormat::qoi;
+	}
+	TGAHeader header;
+	std::memcpy(&header, magic, sizeof(header));
+	if (header.color_map_type == 0 && (header.image_type == 2 || header.image_type == 3) &&
+		(header.bit_count == 8 || header.bit_count == 24 || header.bit_count == 32)) {
+		return ImageFormat::tga;
+	}
+	throw std::runtime_error("Error! Wrong file format");
+}
+
+// The output format follows the file extension; unknown extensions keep the input format.
+static ImageFormat FormatFromExtension(const std::string& path, ImageFormat fallback) {
+	std::string extension = std::filesystem::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+	if (extension == ".bmp") {
+		return ImageFormat::bmp;
+	} else if (extension == ".pgm") {
+		return ImageFormat::pgm;
+	} else if (extension == ".ppm") {
+		return ImageFormat::ppm;
+	} else if (extension == ".tga") {
+		return ImageFormat::tga;
+	} else if (extension == ".qoi") {
+		return ImageFormat::qoi;
+	}
+	return fallback;
+}
+
+static std::unique_ptr<Image> CreateImage(ImageFormat format) {
+	switch (format) {
+	case ImageFormat::bmp: return std::make_unique<BMP>();
+	case ImageFormat::pgm: return std::make_unique<PNM>(true);
+	case ImageFormat::ppm: return std::make_unique<PNM>(false);
+	case ImageFormat::tga: return std::make_unique<TGA>();
+	default: return std::make_unique<QOI>();
+	}
+}
+
+// Copies the pixels into a new image of the given format, keeping the alpha
+// channel only if some pixel actually uses it.
+static std::unique_ptr<Image> ConvertImage(Image& source, ImageFormat format) {
+	std::unique_ptr<Image> target = CreateImage(format);
+	bool alpha = false;
+	for (int y = 0; y < source.GetHeight() && !alpha; y++) {
+		const Pixel* row = source.GetRow(y);
+		for (int x = 0; x < source.GetWidth(); x++) {
+			alpha = alpha || row[x].A != 255;
+		}
+	}
+	target->SetAlphaChannel(alpha);
+	target->Resize(source.GetWidth(), source.GetHeight());
+	for (int y = 0; y < source.GetHeight(); y++) {
+		std::copy(source.GetRow(y), source.GetRow(y) + source.GetWidth(), target->GetRow(y));
+	}
+	return target;
+}
+
+// Streaming mode: the image is never loaded as a whole, rows go from the input file
+// through the filter windows straight into the output file.
+// Returns the number of pixels read.
+static uint64_t StreamBMP(const std::string& in_file, const std::string& out_file, const std::vector<const Filter*>& filters) {
+	std::ifstream fin(in_file, std::ios::binary);
+	if (!fin) {
+		throw std::runtime_error("Error! Unable to open the file");
+	}
+	BMP bmp;
+	bmp.ReadHeaders(fin);
+	BMP out_bmp;
+	std::vector<uint8_t> write_buffer;
+	std::ofstream fout;
+	// Built before the output is opened: it throws for chains that cannot run row by row.
+	RowPipeline pipeline(filters, bmp.GetWidth(), bmp.GetHeight(), [&](int, Pixel* row) {
+		out_bmp.WriteRow(fout, row, write_buffer);
+	});
+	// The output is written next to the target and only replaces it once complete, so a failure
+	// leaves the target (possibly the input itself) untouched.
+	std::string temp_file = out_file + ".part";
+	fout.open(temp_file, std::ios::binary);
+	if (!fout) {
+		throw std::runtime_error("Error! Unable to open the file");
+	}
+	try {
+		out_bmp.file_header = bmp.file_header;
+		out_bmp.info_header = bmp.info_header;
+		out_bmp.color_header = bmp.color_header;
+		if (pipeline.Resizes()) {
+			out_bmp.SetSize(pipeline.GetOutputWidth(), pipeline.GetOutputHeight());
+		}
+		out_bmp.WriteHeaders(fout);
+		std::vector<Pixel> row(bmp.GetWidth());
+		std::vector<uint8_t> read_buffer;
+		for (int y = 0; y < bmp.GetHeight(); y++) {
+			bmp.ReadRow(fin, row.data(), read_buffer);
+			pipeline.Push(y, row.data());
+		}
+		pipeline.Finish();
+		fin.close();
+		fout.close();
+		if (!fout) {
+			throw std::runtime_error("Error! Unable to write the file");
+		}
+		// rename() does not replace an existing file everywhere, so the target is removed on failure.
+		if (std::rename(temp_file.c_str(), out_file.c_str()) != 0 &&
+			(std::remove(out_file.c_str()) != 0 || std::rename(temp_file.c_str(), out_file.c_str()) != 0)) {
+			throw std::runtime_error("Error! Unable to replace the file " + out_file);
+		}
+	} catch (...) {
+		fout.close();
+		std::remove(temp_file.c_str());
+		throw;
+	}
+	return GetPixelCount(bmp);
+}
+
+// Hands items from one pipeline stage to the next. Push blocks while the queue is full,
+// so a fast stage cannot run away from a slow one.
+template <class T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(std::size_t capacity) : capacity(capacity) {}
+
+	void Push(T item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this]() { return items.size() < capacity; });
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+	}
+
+	// Returns false once the queue is closed and drained.
+	bool Pop(T& item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this]() { return !items.empty() || closed; });
+		if (items.empty()) {
+			return false;
+		}
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	void Close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_empty.notify_all();
+	}
+
+private:
+	std::size_t capacity;
+	bool closed = false;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+};
+
+
+// Pixel buffers handed back by the encoder and reused by the decoder, so that
+// a batch of same-sized images allocates only a handful of buffers.
+class BufferPool {
+public:
+	std::vector<Pixel> Acquire() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (buffers.empty()) {
+			return {};
+		}
+		std::vector<Pixel> buffer = std::move(buffers.back());
+		buffers.pop_back();
+		return buffer;
+	}
+
+	void Release(std::vector<Pixel>&& buffer) {
+		std::lock_guard<std::mutex> lock(mutex);
+		buffers.push_back(std::move(buffer));
+	}
+
+private:
+	std::mutex mutex;
+	std::vector<std::vector<Pixel>> buffers;
+};
+
+
+struct BatchItem {
+	std::string in_file;
+	std::string out_file;
+	std::unique_ptr<BMP> image;
+};
+
+
+// Collects the .bmp files of a directory, or the lines of a list file.
+static std::vector<std::string> ListBatchFiles(const std::string& source) {
+	std::vector<std::string> files;
+	if (std::filesystem::is_directory(source)) {
+		for (const auto& entry : std::filesystem::directory_iterator(source)) {
+			std::string extension = entry.path().extension().string();
+			std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+			if (entry.is_regular_file() && extension == ".bmp") {
+				files.push_back(entry.path().string());
+			}
+		}
+		std::sort(files.begin(), files.end());
+		return files;
+	}
+	std::ifstream list(source);
+	if (!list) {
+		throw std::runtime_error("Error! Unable to open the file");
+	}
+	std::string line;
+	while (std::getline(list, line)) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if (!line.empty()) {
+			files.push_back(line);
+		}
+	}
+	return files;
+}
+
+// Batch mode: decoding, filtering and encoding run as three overlapped stages connected by
+// bounded queues, so disk I/O of one image hides behind the filtering of another.
+// Returns the number of files that failed.
+static std::size_t RunBatch(const std::string& source, const std::string& out_dir, const std::vector<const Filter*>& filters, bool row_chain, Profiler& profiler) {
+	const std::size_t queue_capacity = 4;
+	std::vector<std::string> files = ListBatchFiles(source);
+	std::filesystem::create_directories(out_dir);
+	BufferPool pool;
+	BoundedQueue<BatchItem> decoded(queue_capacity);
+	BoundedQueue<BatchItem> filtered(queue_capacity);
+	std::mutex report_mutex;
+	std::size_t failed = 0;
+	auto report = [&](const std::string& file, const std::exception& error) {
+		std::lock_guard<std::mutex> lock(report_mutex);
+		std::cerr << file << ": " << error.what() << '\n';
+		failed++;
+	};
+
+	std::thread decoder([&]() {
+		for (const std::string& file : files) {
+			BatchItem item;
+			item.in_file = file;
+			item.out_file = (std::filesystem::path(out_dir) / std::filesystem::path(file).filename()).string();
+			item.image = std::make_unique<BMP>();
+			item.image->pixel_data = pool.Acquire();
+			try {
+				std::ifstream fin(file, std::ios::binary);
+				if (!fin) {
+					throw std::runtime_error("Error! Unable to open the file");
+				}
+				profiler.Measure("decode", [&]() {
+					item.image->Read(fin);
+					return GetPixelCount(*item.image);
+				});
+			} catch (const std::exception& error) {
+				report(file, error);
+				pool.Release(std::move(item.image->pixel_data));
+				continue;
+			}
+			decoded.Push(std::move(item));
+		}
+		decoded.Close();
+	});
+	std::thread encoder([&]() {
+		BatchItem item;
+		while (filtered.Pop(item)) {
+			try {
+				std::ofstream fout(item.out_file, std::ios::binary);
+				if (!fout) {
+					throw std::runtime_error("Error! Unable to open the file");
+				}
+				profiler.Measure("encode", [&]() {
+					item.image->Write(fout);
+					return GetPixelCount(*item.image);
+				});
+			} catch (const std::exception& error) {
+				report(item.out_file, error);
+			}
+			pool.Release(std::move(item.image->pixel_data));
+		}
+	});
+
+	BatchItem item;
+	while (decoded.Pop(item)) {
+		try {
+			profiler.Measure("filter", [&]() {
+				uint64_t pixels = GetPixelCount(*item.image);
+				if (row_chain) {
+					ApplyRowFilters(*item.image, filters);
+				} else {
+					for (const Filter* filter : filters) {
+						filter->Apply(*item.image);
+					}
+				}
+				return pixels;
+			});
+		} catch (const std::exception& error) {
+			report(item.in_file, error);
+			pool.Release(std::move(item.image->pixel_data));
+			continue;
+		}
+		filtered.Push(std::move(item));
+	}
+	filtered.Close();
+	decoder.join();
+	encoder.join();
+	return failed;
+}
+
+
+using FilterFactory = std::unordered_map<std::string, std::function<std::unique_ptr<Filter>()>>;
+
+// Runs every registered filter over synthetic 24 and 32 bit images of the given
+// sizes in megapixels and prints the best of a few runs as CSV. Every run decodes
+// the pixels from the BMP layout, filters them and encodes them back, so the bit
+// depths differ by the cost of unpacking and packing the rows. Point-wise
+// filters are measured both directly and compiled into a lookup table.
+static int RunBenchmark(FilterFactory& filters, std::vector<double> sizes) {
+	const int runs = 3;
+	const std::vector<std::pair<std::string, std::vector<std::string>>> samples = {
+		{ "discolor", {} },
+		{ "lighten", { "30" } },
+		{ "darken", { "30" } },
+		{ "colorize", { "30", "red" } },
+		{ "contrast", {} },
+		{ "stretch", { "1", "99" } },
+		{ "equalize", {} },
+		{ "blur", { "2" } },
+		{ "resize", { "320", "240", "lanczos" } },
+		{ "median", { "2" } },
+		{ "erode", { "2" } },
+		{ "dilate", { "2" } }
+	};
+	for (const auto& factory : filters) {
+		auto sample = std::find_if(samples.begin(), samples.end(), [&](const auto& entry) { return entry.first == factory.first; });
+		if (sample == samples.end()) {
+			throw std::runtime_error("Error! No benchmark arguments for " + factory.first);
+		}
+	}
+	if (sizes.empty()) {
+		sizes = { 1, 10, 100 };
+	}
+	std::cout << "filter,bits,megapixels,variant,threads,ms,mpix_per_s\n";
+	for (double megapixels : sizes) {
+		int width = std::max(1, static_cast<int>(std::sqrt(megapixels * 1e6 * 4 / 3)));
+		int height = std::max(1, static_cast<int>(megapixels * 1e6 / width));
+		BMP source;
+		source.Resize(width, height);
+		uint32_t state = 2463534242u;
+		for (int y = 0; y < height; y++) {
+			Pixel* row = source.GetRow(y);
+			for (int x = 0; x < width; x++) {
+				// A gradient with some noise, so that histograms and resampling see varied data.
+				state ^= state << 13;
+				state ^= state >> 17;
+				state ^= state << 5;
+				row[x].B = static_cast<uint8_t>(x * 255 / width + (state & 15));
+				row[x].G = static_cast<uint8_t>(y * 255 / height + (state >> 4 & 15));
+				row[x].R = static_cast<uint8_t>((x + y) + (state >> 8 & 31));
+			}
+		}
+		for (int bits : { 24, 32 }) {
+			std::vector<uint8_t> encoded;
+			std::vector<uint8_t> output;
+			source.SetAlphaChannel(bits == 32);
+			source.EncodePixels(encoded);
+			for (const auto& sample : samples) {
+				std::unique_ptr<Filter> filter = filters[sample.first]();
+				for (std::size_t index = 0; index < sample.second.size(); index++) {
+					filter->SetArguments(index, sample.second[index]);
+				}
+				std::vector<std::unique_ptr<Filter>> compiled;
+				std::vector<std::pair<std::string, const Filter*>> variants = { { "direct", filter.get() } };
+				std::vector<const Filter*> chain = CompileFilters({ filter.get() }, compiled);
+				if (!compiled.empty()) {
+					variants.emplace_back("compiled", chain[0]);
+				}
+				for (const auto& variant : variants) {
+					double best = 0;
+					for (int run = 0; run < runs; run++) {
+						BMP image;
+						image.SetAlphaChannel(bits == 32);
+						image.Resize(width, height);
+						auto begin = std::chrono::steady_clock::now();
+						image.DecodePixels(encoded);
+						variant.second->Apply(image);
+						image.EncodePixels(output);
+						std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+						best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+					}
+					std::cout << sample.first << ',' << bits << ',' << megapixels << ',' << variant.first << ',' << GetThreadCount() << ',' <<
+						best * 1000 << ',' << static_cast<double>(width) * height / best / 1e6 << '\n';
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	FilterFactory filters // Naosareta
+	{
+		{ "discolor", []() -> std::unique_ptr<Filter> { return std::make_unique<DiscolorFilter>(); } },
+		{ "lighten", []() -> std::unique_ptr<Filter> { return std::make_unique<LightenFilter>(); } },
+		{ "darken", []() -> std::unique_ptr<Filter> { return std::make_unique<DarkenFilter>(); } },
+		{ "colorize", []() -> std::unique_ptr<Filter> { return std::make_unique<ColorFilter>(); } },
+		{ "contrast", []() -> std::unique_ptr<Filter> { return std::make_unique<ContrastFilter>(); } },
+		{ "stretch", []() -> std::unique_ptr<Filter> { return std::make_unique<StretchFilter>(); } },
+		{ "equalize", []() -> std::unique_ptr<Filter> { return std::make_unique<EqualizeFilter>(); } },
+		{ "blur", []() -> std::unique_ptr<Filter> { return std::make_unique<BlurFilter>(); } },
+		{ "resize", []() -> std::unique_ptr<Filter> { return std::make_unique<ResizeFilter>(); } },
+		{ "median", []() -> std::unique_ptr<Filter> { return std::make_unique<MedianFilter>(); } },
+		{ "erode", []() -> std::unique_ptr<Filter> { return std::make_unique<MorphologyFilter>(false); } },
+		{ "dilate", []() -> std::unique_ptr<Filter> { return std::make_unique<MorphologyFilter>(true); } }
+	};
+	std::ifstream fin;
+	int arg_pos = 1;
+	bool streaming = false;
+	bool batch = false;
+	bool profile = false;
+	std::string out_dir;
+	if (argc < 2) {
+		throw std::runtime_error("Error! Wromg number of arguments");
+	}
 	std::string first_arg = argv[arg_pos];
 	arg_pos++;
+	while (first_arg.compare(0, 2, "--") == 0) {
+		if (first_arg == "--benchmark") {
+			std::vector<double> sizes;
+			for (; arg_pos < argc; arg_pos++) {
+				sizes.push_back(std::stod(argv[arg_pos]));
+			}
+			return RunBenchmark(filters, sizes);
+		}
+		if (first_arg == "--stream") {
+			streaming = true;
+		} else if (first_arg == "--batch") {
+			batch = true;
+		} else if (first_arg == "--profile") {
+			profile = true;
+		} else if (first_arg == "--threads" && arg_pos < argc) {
+			thread_limit = std::max(1, std::stoi(argv[arg_pos]));
+			arg_pos++;
+		} else {
+			throw std::runtime_error("Error! Unknown option " + first_arg);
+		}
+		if (arg_pos == argc) {
+			throw std::runtime_error("Error! Wromg number of arguments");
+		}
+		first_arg = argv[arg_pos];
+		arg_pos++;
+	}
+	if (batch) {
+		if (arg_pos + 1 >= argc) {
+			throw std::runtime_error("Error! Wromg number of arguments");
+		}
+		out_dir = argv[arg_pos];
+		arg_pos++;
+	}
 	if (argc == 2 && first_arg == "help") {
-		std::cerr << "Welcome to image redactor! At a certain moment it is possible to work only with bmp images. Available commands:" <<
-			"\ndiscolor;\nlighten -integer-;\ndarken -integer-;\nblue -integer-;\nred -integer-;\ngreen -integer-;\ncontrast;\nblur -integer-;\nhelp;" <<
-			"\nAvailable command formats :\nimage_redactor.exe file_to_read_and_write command (optional)integer;\nimage_redactor.exe file_to_read command (optional)integer file_to_write;;\nimage_redactor.exe file_to_read colorize integer blue/red/green (optional)file_to_write;\nimage_redactor.exe help;";
+		std::cerr << "Welcome to image redactor! It works with bmp, ppm/pgm, uncompressed tga and qoi images; the output format follows the extension of file_to_write. Available commands:" <<
+			"\ndiscolor;\nlighten -integer-;\ndarken -integer-;\nblue -integer-;\nred -integer-;\ngreen -integer-;\ncontrast;\nstretch -low percent- -high percent-;\nequalize;\nblur -integer-;\nresize -width- -height- nearest/bilinear/lanczos;\nmedian -integer-;\nerode -integer-;\ndilate -integer-;\nhelp;" <<
+			"\nAvailable command formats :\nimage_redactor.exe file_to_read_and_write command (optional)integer;\nimage_redactor.exe file_to_read command (optional)integer file_to_write;;\nimage_redactor.exe file_to_read colorize integer blue/red/green (optional)file_to_write;" <<
+			"\nimage_redactor.exe file_to_read command1 (optional)integer command2 (optional)integer ... (optional)file_to_write;" <<
+			"\nimage_redactor.exe --stream file_to_read commands (optional)file_to_write; (row by row, for images that do not fit in memory)" <<
+			"\nimage_redactor.exe --batch directory_or_file_list output_directory commands;" <<
+			"\nimage_redactor.exe --profile ... ; (prints the time of every stage and the peak memory)\nimage_redactor.exe --threads -integer- ... ;" <<
+			"\nimage_redactor.exe --benchmark (optional)megapixels ... ; (runs every command on synthetic images)\nimage_redactor.exe help;";
 		return -1;
 	}
-	fin.open(first_arg, std::ios::binary);
-	if (fin) {
-		bmp.Read(fin);
-	} else {
-		throw std::runtime_error("Error! Unable to open the file");
-	}
-	fin.close();
-	std::string command = argv[arg_pos];
-	arg_pos++;
-	std::unique_ptr<Filter> filter = filters[command]();
-	for (std::size_t arg_count = 0; arg_count < filter->GetArity(); arg_count++) {
-		std::string val = argv[arg_pos];
+	std::vector<std::unique_ptr<Filter>> chain;
+	std::vector<std::string> chain_names;
+	Profiler profiler(profile);
+	do {
+		std::string command = argv[arg_pos];
 		arg_pos++;
-		filter->SetArguments(arg_count, val);
+		if (filters.count(command) == 0) {
+			throw std::runtime_error("Error! Unknown command " + command);
+		}
+		std::unique_ptr<Filter> filter = filters[command]();
+		for (std::size_t arg_count = 0; arg_count < filter->GetArity(); arg_count++) {
+			if (arg_pos == argc) {
+				throw std::runtime_error("Error! Wromg number of arguments");
+			}
+			std::string val = argv[arg_pos];
+			arg_pos++;
+			filter->SetArguments(arg_count, val);
+		}
+		chain.push_back(std::move(filter));
+		chain_names.push_back(command);
+	} while (arg_pos < argc && filters.count(argv[arg_pos]) != 0);
+	std::vector<const Filter*> chain_view;
+	for (const std::unique_ptr<Filter>& filter : chain) {
+		chain_view.push_back(filter.get());
 	}
-	filter->Apply(bmp);
-	std::ofstream fout;
-	if (arg_pos == argc) {
-		fout.open(first_arg, std::ios::binary);
-	} else {
-		std::string file = argv[arg_pos];
-		fout.open(file, std::ios::binary);
+	chain_view = CompileFilters(chain_view, chain, &chain_names);
+	bool row_chain = true;
+	for (const Filter* filter : chain_view) {
+		row_chain = row_chain && filter->IsStreamable();
+	}
+	if (batch) {
+		if (arg_pos != argc) {
+			throw std::runtime_error("Error! Unknown command " + std::string(argv[arg_pos]));
+		}
+		std::size_t failed = RunBatch(first_arg, out_dir, chain_view, row_chain, profiler);
+		profiler.Report(std::cerr);
+		return failed == 0 ? 0 : 1;
+	}
+	std::string out_file = arg_pos == argc ? first_arg : argv[arg_pos];
+	ImageFormat in_format = DetectFormat(first_arg);
+	ImageFormat out_format = FormatFromExtension(out_file, in_format);
+	if (streaming) {
+		if (in_format != ImageFormat::bmp || out_format != ImageFormat::bmp) {
+			throw std::runtime_error("Error! Streaming mode works only with bmp images");
+		}
+		profiler.Measure("stream", [&]() { return StreamBMP(first_arg, out_file, chain_view); });
+		profiler.Report(std::cerr);
+		return 0;
 	}
-	if (fout) {
-		bmp.Write(fout);
+	std::unique_ptr<Image> image = CreateImage(in_format);
+	BMP* bmp = in_format == ImageFormat::bmp ? static_cast<BMP*>(image.get()) : nullptr;
+	profiler.Measure("decode", [&]() {
+		if (bmp == nullptr || out_format != in_format || !bmp->Map(first_arg, out_file == first_arg)) {
+			fin.open(first_arg, std::ios::binary);
+			if (fin) {
+				image->Read(fin);
+			} else {
+				throw std::runtime_error("Error! Unable to open the file");
+			}
+			fin.close();
+		}
+		return GetPixelCount(*image);
+	});
+	if (profile) {
+		// Every filter is timed on its own pass instead of sharing one row pass.
+		for (std::size_t index = 0; index < chain_view.size(); index++) {
+			profiler.Measure(chain_names[index], [&]() {
+				uint64_t pixels = GetPixelCount(*image);
+				chain_view[index]->Apply(*image);
+				return pixels;
+			});
+		}
+	} else if (row_chain) {
+		ApplyRowFilters(*image, chain_view);
 	} else {
-		throw std::runtime_error("Error! Unable to open the file");
+		for (const Filter* filter : chain_view) {
+			filter->Apply(*image);
+		}
 	}
+	profiler.Measure("encode", [&]() {
+		if (bmp != nullptr && bmp->IsMappedInPlace()) {
+			bmp->Flush();
+			return GetPixelCount(*image);
+		}
+		if (out_format != in_format) {
+			image = ConvertImage(*image, out_format);
+		}
+		std::ofstream fout;
+		fout.open(out_file, std::ios::binary);
+		if (fout) {
+			image->Write(fout);
+		} else {
+			throw std::runtime_error("Error! Unable to open the file");
+		}
+		return GetPixelCount(*image);
+	});
+	profiler.Report(std::cerr);
 	return 0;
 }	
\ No newline at end of file
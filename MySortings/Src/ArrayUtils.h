@@ -1,35 +1,217 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
-#include <random>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 
-enum class ArrayTypeChoice { random, asc_order, desc_order, copy };
+#include "ThreadPool.h"
+
+enum class ArrayTypeChoice { random, asc_order, desc_order, few_unique, organ_pipe, sawtooth, full_range, almost_sorted, normal, all_equal, copy };
+
+// Seed used when the caller gives none, so that equal calls create equal arrays.
+const std::uint64_t default_array_seed = 0x853C49E6748FEA9B;
 
 namespace ArrayDetails {
-	inline void FillRandom(int* arr, std::size_t size) {
-		srand(time(nullptr));
-		for (std::size_t index = 0; index < size; index++) {
-			arr[index] = rand() % size + 1;
+	// Arrays are filled in blocks of this many elements, in parallel from the threshold on. The
+	// random values depend on the seed and the element index only, so the result is the same
+	// whatever the block order and the number of threads.
+	const std::size_t fill_block_size = 1 << 16;
+	const std::size_t parallel_fill_threshold = 1 << 18;
+	// Values from 1 to this bound only, so most of them repeat.
+	const int few_unique_values = 16;
+	// Out of every 2^32 elements of an almost sorted array, this many get a random value.
+	const std::uint32_t almost_sorted_noise = 1u << 25;
+
+	// Independent generators advanced side by side; the lanes do not depend on each other, so
+	// the update vectorizes.
+	const std::size_t xoshiro_lanes = 8;
+
+	inline std::uint64_t SplitMix64(std::uint64_t& state) {
+		std::uint64_t z = state += 0x9E3779B97F4A7C15;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+		return z ^ (z >> 31);
+	}
+
+	inline std::uint64_t RotateLeft(std::uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	// xoshiro256** (Blackman and Vigna, "Scrambled linear pseudorandom number generators").
+	inline std::uint64_t XoshiroNext(std::uint64_t (&s)[4]) {
+		std::uint64_t result = RotateLeft(s[1] * 5, 7) * 9;
+		std::uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = RotateLeft(s[3], 45);
+		return result;
+	}
+
+	// Advances the generator by 2^128 steps, so generators jumped a different number of times
+	// never produce overlapping sequences.
+	inline void XoshiroJump(std::uint64_t (&s)[4]) {
+		static const std::uint64_t jump[4] = { 0x180EC6D33CFD0ABA, 0xD5A61266F0C9392C, 0xA9582618E03FC9AA, 0x39ABDC4529B1661C };
+		std::uint64_t t[4] = {};
+		for (std::uint64_t word : jump) {
+			for (int bit = 0; bit < 64; bit++) {
+				if (word & std::uint64_t(1) << bit) {
+					for (int index = 0; index < 4; index++) t[index] ^= s[index];
+				}
+				XoshiroNext(s);
+			}
 		}
+		for (int index = 0; index < 4; index++) s[index] = t[index];
 	}
+
+	// xoshiro_lanes generators stored word by word. Stream number stream of a seed starts from a
+	// state drawn with SplitMix64 and the lanes jump ahead of each other from it.
+	struct XoshiroLanes {
+		std::uint64_t s[4][xoshiro_lanes];
+
+		XoshiroLanes(std::uint64_t seed, std::uint64_t stream) {
+			std::uint64_t mix = seed ^ SplitMix64(stream);
+			std::uint64_t state[4];
+			for (std::uint64_t& word : state) word = SplitMix64(mix);
+			for (std::size_t lane = 0; lane < xoshiro_lanes; lane++) {
+				for (int index = 0; index < 4; index++) s[index][lane] = state[index];
+				XoshiroJump(state);
+			}
+		}
+
+		void Next(std::uint64_t (&out)[xoshiro_lanes]) {
+			for (std::size_t lane = 0; lane < xoshiro_lanes; lane++) {
+				std::uint64_t s1 = s[1][lane];
+				out[lane] = RotateLeft(s1 * 5, 7) * 9;
+				std::uint64_t s2 = s[2][lane] ^ s[0][lane];
+				std::uint64_t s3 = s[3][lane] ^ s1;
+				s[1][lane] = s1 ^ s2;
+				s[0][lane] ^= s3;
+				s[2][lane] = s2 ^ (s1 << 17);
+				s[3][lane] = RotateLeft(s3, 45);
+			}
+		}
+	};
+
+	// Upper half of the 128-bit product: maps a uniform 64-bit value onto [0, range) with a bias
+	// of at most range / 2^64, unlike the modulo.
+	inline std::uint64_t MulHigh(std::uint64_t a, std::uint64_t b) {
+#ifdef __SIZEOF_INT128__
+		return static_cast<std::uint64_t>((static_cast<unsigned __int128>(a) * b) >> 64);
+#else
+		std::uint64_t a_lo = static_cast<std::uint32_t>(a), a_hi = a >> 32;
+		std::uint64_t b_lo = static_cast<std::uint32_t>(b), b_hi = b >> 32;
+		std::uint64_t hi_lo = a_hi * b_lo;
+		std::uint64_t cross = ((a_lo * b_lo) >> 32) + static_cast<std::uint32_t>(hi_lo) + a_lo * b_hi;
+		return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+	}
+
+	// Calls fill(begin, end) for consecutive blocks of [0, size).
+	template <class Fill>
+	void FillBlocks(std::size_t size, const Fill& fill) {
+		std::size_t block_count = (size + fill_block_size - 1) / fill_block_size;
+		auto body = [&fill, size](std::size_t block) {
+			std::size_t begin = block * fill_block_size;
+			fill(begin, std::min(size, begin + fill_block_size));
+		};
+		if (size < parallel_fill_threshold) {
+			for (std::size_t block = 0; block < block_count; block++) body(block);
+		}
+		else {
+			ThreadPool::GetDefault().ForEach(block_count, body);
+		}
+	}
+
+	// Sets arr[index] = value(bits, index), where bits are 64 random bits. Every block draws from
+	// its own stream, so its values depend on the seed and the block index only.
+	template <class Value>
+	void FillRandom(int* arr, std::size_t size, std::uint64_t seed, const Value& value) {
+		FillBlocks(size, [arr, seed, &value](std::size_t begin, std::size_t end) {
+			XoshiroLanes generator(seed, begin / fill_block_size);
+			std::uint64_t bits[xoshiro_lanes];
+			for (std::size_t first = begin; first < end; first += xoshiro_lanes) {
+				generator.Next(bits);
+				std::size_t count = std::min(xoshiro_lanes, end - first);
+				for (std::size_t lane = 0; lane < count; lane++) arr[first + lane] = value(bits[lane], first + lane);
+			}
+		});
+	}
+
+	template <class Value>
+	void FillIndexed(int* arr, std::size_t size, const Value& value) {
+		FillBlocks(size, [arr, &value](std::size_t begin, std::size_t end) {
+			for (std::size_t index = begin; index < end; index++) arr[index] = value(index);
+		});
+	}
+
 	inline void Copy(int* d_arr, const int* s_arr, std::size_t size) {
-		for (std::size_t index = 0; index < size; index++) {
-			d_arr[index] = s_arr[index];
+		FillBlocks(size, [d_arr, s_arr](std::size_t begin, std::size_t end) {
+			std::memcpy(d_arr + begin, s_arr + begin, (end - begin) * sizeof(int));
+		});
+	}
+
+	inline void Fill(int* arr, std::size_t size, ArrayTypeChoice type, std::uint64_t seed) {
+		std::uint64_t range = std::max<std::size_t>(size, 1);
+		switch (type) {
+		case ArrayTypeChoice::random: FillRandom(arr, size, seed, [range](std::uint64_t bits, std::size_t) {
+			return static_cast<int>(MulHigh(bits, range) + 1);
+		}); break;
+		case ArrayTypeChoice::asc_order: FillIndexed(arr, size, [](std::size_t index) {
+			return static_cast<int>(index + 1);
+		}); break;
+		case ArrayTypeChoice::desc_order: FillIndexed(arr, size, [size](std::size_t index) {
+			return static_cast<int>(size - index);
+		}); break;
+		case ArrayTypeChoice::few_unique: FillRandom(arr, size, seed, [](std::uint64_t bits, std::size_t) {
+			return static_cast<int>(MulHigh(bits, few_unique_values) + 1);
+		}); break;
+		// Ascending up to the middle, then descending.
+		case ArrayTypeChoice::organ_pipe: FillIndexed(arr, size, [size](std::size_t index) {
+			return static_cast<int>(std::min(index, size - 1 - index) + 1);
+		}); break;
+		// About sqrt(size) ascending runs of sqrt(size) elements each.
+		case ArrayTypeChoice::sawtooth: {
+			std::size_t period = std::max<std::size_t>(1, static_cast<std::size_t>(std::sqrt(static_cast<double>(size))));
+			FillBlocks(size, [arr, period](std::size_t begin, std::size_t end) {
+				std::size_t value = begin % period;
+				for (std::size_t index = begin; index < end; index++) {
+					arr[index] = static_cast<int>(value + 1);
+					if (++value == period) value = 0;
+				}
+			});
+		} break;
+		case ArrayTypeChoice::full_range: FillRandom(arr, size, seed, [](std::uint64_t bits, std::size_t) {
+			return static_cast<int>(static_cast<std::uint32_t>(bits));
+		}); break;
+		// Ascending, with about one element in 128 replaced by a random value.
+		case ArrayTypeChoice::almost_sorted: FillRandom(arr, size, seed, [range](std::uint64_t bits, std::size_t index) {
+			if (static_cast<std::uint32_t>(bits) >= almost_sorted_noise) return static_cast<int>(index + 1);
+			return static_cast<int>(MulHigh(bits, range) + 1);
+		}); break;
+		// Sum of four uniform 16-bit values (Irwin-Hall), close to a normal distribution around size / 2.
+		case ArrayTypeChoice::normal: FillRandom(arr, size, seed, [range](std::uint64_t bits, std::size_t) {
+			std::uint64_t sum = (bits & 0xFFFF) + (bits >> 16 & 0xFFFF) + (bits >> 32 & 0xFFFF) + (bits >> 48);
+			// sum * range / 2^18, without overflowing the product for large sizes.
+			return static_cast<int>(MulHigh(sum << 46, range) + 1);
+		}); break;
+		case ArrayTypeChoice::all_equal: FillIndexed(arr, size, [](std::size_t) {
+			return 1;
+		}); break;
+		case ArrayTypeChoice::copy: break;
 		}
 	}
 }
 
-inline std::unique_ptr<int[]> CreateArray(std::size_t size, ArrayTypeChoice type, const int* array_to_copy = nullptr) {
-	std::unique_ptr<int[]> arr = std::make_unique<int[]>(size);
-	switch (type) {
-	case ArrayTypeChoice::random: ArrayDetails::FillRandom(arr.get(), size); break;
-	case ArrayTypeChoice::asc_order: for (std::size_t index = 0; index < size; index++) {
-		arr[index] = index + 1;
-	} break;
-	case ArrayTypeChoice::desc_order: for (int index1 = size - 1, index2 = 0; index1 >= 0; index1--, index2++) {
-		arr[index2] = index1 + 1;
-	} break;
-	case ArrayTypeChoice::copy: ArrayDetails::Copy(arr.get(), array_to_copy, size);
-	}	return arr;
+// The elements are left uninitialized by the allocation, since every type writes all of them.
+inline std::unique_ptr<int[]> CreateArray(std::size_t size, ArrayTypeChoice type, const int* array_to_copy = nullptr, std::uint64_t seed = default_array_seed) {
+	std::unique_ptr<int[]> arr(new int[size]);
+	if (type == ArrayTypeChoice::copy) ArrayDetails::Copy(arr.get(), array_to_copy, size);
+	else ArrayDetails::Fill(arr.get(), size, type, seed);
+	return arr;
 }
-
@@ -0,0 +1,107 @@
+#include "Benchmark.h"
+#include "Sortings.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+// Indexed by ArrayTypeChoice.
+static const char* const distribution_names[] = { "random", "sorted", "reverse", "few-unique", "organ-pipe", "sawtooth", "full-range", "almost-sorted", "normal", "all-equal" };
+
+ArrayTypeChoice ParseDistribution(const std::string& name) {
+	for (std::size_t index = 0; index < std::size(distribution_names); index++) {
+		if (name == distribution_names[index]) return static_cast<ArrayTypeChoice>(index);
+	}
+	throw std::runtime_error("Error! Unknown distribution " + name);
+}
+
+struct CaseResult {
+	double median_ns = 0;
+	double min_ns = 0;
+	double p95_ns = 0;
+	std::size_t comparisons = 0;
+	std::size_t moves = 0;
+	HardwareCounts hardware;
+	bool sorted = true;
+};
+
+static CaseResult RunCase(const SortingEntry& sorting, const int* input, int* arr, std::size_t size, const BenchmarkOptions& options) {
+	CaseResult result;
+	std::vector<double> times;
+	SortReport report;
+	SetSortReport(&report);
+	for (std::size_t run = 0; run < options.warmups + options.repeats; run++) {
+		std::copy(input, input + size, arr);
+		sorting.sort(arr, size);
+		result.sorted = result.sorted && report.sorted;
+		if (run < options.warmups) continue;
+		times.push_back(static_cast<double>(report.time.count()) / std::max<std::size_t>(size, 1));
+		result.comparisons = report.comparisons;
+		result.moves = report.moves;
+		result.hardware = report.hardware;
+	}
+	SetSortReport(nullptr);
+	std::sort(times.begin(), times.end());
+	result.min_ns = times.front();
+	result.median_ns = times.size() % 2 ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+	result.p95_ns = times[(times.size() * 95 + 99) / 100 - 1];
+	return result;
+}
+
+void RunBenchmark(const BenchmarkOptions& options, std::ostream& out) {
+	if (options.repeats == 0) {
+		throw std::runtime_error("Error! At least one repeat is needed");
+	}
+	std::vector<std::size_t> sizes = options.sizes;
+	std::sort(sizes.begin(), sizes.end());
+	std::size_t max_size = sizes.empty() ? 0 : sizes.back();
+	std::unique_ptr<int[]> arr = std::make_unique<int[]>(max_size);
+	if (options.json) out << "[";
+	else out << "algorithm,distribution,size,repeats,median_ns_per_element,min_ns_per_element,p95_ns_per_element,comparisons,moves,sorted";
+	if (perf_counters_enabled && !options.json) out << ",cycles,instructions,branch_misses,cache_misses";
+	if (!options.json) out << "\n";
+	bool first_row = true;
+	for (ArrayTypeChoice distribution : options.distributions) {
+		std::vector<bool> too_slow(options.sortings.size(), false);
+		for (std::size_t size : sizes) {
+			std::unique_ptr<int[]> input = CreateArray(size, distribution, nullptr, options.seed);
+			for (std::size_t index = 0; index < options.sortings.size(); index++) {
+				if (too_slow[index]) continue;
+				const SortingEntry& sorting = *options.sortings[index];
+				CaseResult result = RunCase(sorting, input.get(), arr.get(), size, options);
+				if (result.median_ns * size > options.time_limit_ms * 1e6) too_slow[index] = true;
+				const char* distribution_name = distribution_names[static_cast<std::size_t>(distribution)];
+				if (options.json) {
+					out << (first_row ? "\n" : ",\n")
+						<< "  {\"algorithm\": \"" << sorting.key << "\", \"distribution\": \"" << distribution_name
+						<< "\", \"size\": " << size << ", \"repeats\": " << options.repeats
+						<< ", \"median_ns_per_element\": " << result.median_ns << ", \"min_ns_per_element\": " << result.min_ns
+						<< ", \"p95_ns_per_element\": " << result.p95_ns << ", \"comparisons\": " << result.comparisons
+						<< ", \"moves\": " << result.moves << ", \"sorted\": " << (result.sorted ? "true" : "false");
+					if (perf_counters_enabled && result.hardware.valid) {
+						out << ", \"cycles\": " << result.hardware.cycles << ", \"instructions\": " << result.hardware.instructions
+							<< ", \"branch_misses\": " << result.hardware.branch_misses << ", \"cache_misses\": " << result.hardware.cache_misses;
+					}
+					else if (perf_counters_enabled) {
+						out << ", \"cycles\": null, \"instructions\": null, \"branch_misses\": null, \"cache_misses\": null";
+					}
+					out << "}";
+				}
+				else {
+					out << sorting.key << "," << distribution_name << "," << size << "," << options.repeats << ","
+						<< result.median_ns << "," << result.min_ns << "," << result.p95_ns << ","
+						<< result.comparisons << "," << result.moves << "," << (result.sorted ? "yes" : "no");
+					if (perf_counters_enabled && !result.hardware.valid) out << ",,,,";
+					else if (perf_counters_enabled) {
+						out << "," << result.hardware.cycles << "," << result.hardware.instructions << ","
+							<< result.hardware.branch_misses << "," << result.hardware.cache_misses;
+					}
+					out << "\n";
+				}
+				out.flush();
+				first_row = false;
+			}
+		}
+	}
+	if (options.json) out << "\n]\n";
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ArrayUtils.h"
+
+struct SortingEntry {
+	const char* key;
+	const char* name;
+	void (*sort)(int* arr, std::size_t size);
+};
+
+struct BenchmarkOptions {
+	std::vector<const SortingEntry*> sortings;
+	std::vector<std::size_t> sizes = { 1000, 100000, 1000000 };
+	std::vector<ArrayTypeChoice> distributions = { ArrayTypeChoice::random, ArrayTypeChoice::asc_order, ArrayTypeChoice::desc_order,
+		ArrayTypeChoice::few_unique, ArrayTypeChoice::organ_pipe, ArrayTypeChoice::sawtooth };
+	std::uint64_t seed = default_array_seed;
+	std::size_t warmups = 2;
+	std::size_t repeats = 11;
+	// A sorting that needs longer than this for one run is not measured on larger sizes of
+	// the same distribution, which keeps the quadratic sorts out of the big cases.
+	double time_limit_ms = 1000;
+	bool json = false;
+};
+
+// Parses "random", "sorted", "reverse", "few-unique", "organ-pipe", "sawtooth", "full-range",
+// "almost-sorted", "normal" or "all-equal"; throws std::runtime_error for anything else.
+ArrayTypeChoice ParseDistribution(const std::string& name);
+
+// Runs every sorting on every size and distribution: warmups untimed runs first, then repeats
+// timed ones, each on a fresh copy of the same input. Writes one CSV row or JSON object per
+// case with the median, minimum and 95th percentile time in nanoseconds per element, and the
+// hardware counters of the last run when they are compiled in.
+void RunBenchmark(const BenchmarkOptions& options, std::ostream& out);
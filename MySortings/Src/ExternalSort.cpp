@@ -0,0 +1,306 @@
+#include "ExternalSort.h"
+#include "Sortings.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+// Runs merged at once at most; with more runs the merge takes several passes.
+static const std::size_t max_merge_ways = 512;
+// Smallest buffer worth a read or a write call; the fan-in shrinks to keep buffers above it.
+static const std::size_t min_buffer_bytes = 1 << 16;
+static_assert(external_sort_min_memory >= 6 * min_buffer_bytes, "the budget must allow a two-way merge");
+
+// Reads a run sequentially. While the merge consumes one buffer, the next one is filled by an
+// asynchronous read, so the merge rarely waits for the disk.
+class RunReader {
+public:
+	RunReader(const std::string& path, std::size_t buffer_size) : file(path, std::ios::binary), current(buffer_size), next(buffer_size) {
+		if (!file) {
+			throw std::runtime_error("Error! Unable to open the file " + path);
+		}
+		count = Read(current);
+		Prefetch();
+	}
+
+	~RunReader() {
+		if (pending.valid()) pending.wait();
+	}
+
+	bool Empty() const {
+		return position == count;
+	}
+
+	int Value() const {
+		return current[position];
+	}
+
+	void Advance() {
+		if (++position == count && count == current.size()) {
+			count = pending.get();
+			std::swap(current, next);
+			position = 0;
+			Prefetch();
+		}
+	}
+
+private:
+	std::ifstream file;
+	std::vector<int> current;
+	std::vector<int> next;
+	std::size_t count = 0;
+	std::size_t position = 0;
+	std::future<std::size_t> pending;
+
+	std::size_t Read(std::vector<int>& buffer) {
+		file.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(int));
+		return static_cast<std::size_t>(file.gcount()) / sizeof(int);
+	}
+
+	void Prefetch() {
+		if (count == current.size()) {
+			pending = std::async(std::launch::async, [this]() { return Read(next); });
+		}
+	}
+};
+
+// Writes through two buffers: a full buffer is written asynchronously while the other fills.
+class RunWriter {
+public:
+	RunWriter(const std::string& path, std::size_t buffer_size) : file(path, std::ios::binary), current(buffer_size), next(buffer_size) {
+		if (!file) {
+			throw std::runtime_error("Error! Unable to open the file " + path);
+		}
+	}
+
+	~RunWriter() {
+		if (pending.valid()) pending.wait();
+	}
+
+	void Push(int value) {
+		current[count++] = value;
+		if (count == current.size()) Flush();
+	}
+
+	void Close() {
+		Flush();
+		Wait();
+		file.close();
+		if (!file) {
+			throw std::runtime_error("Error! Unable to write the file");
+		}
+	}
+
+private:
+	std::ofstream file;
+	std::vector<int> current;
+	std::vector<int> next;
+	std::size_t count = 0;
+	std::future<void> pending;
+
+	void Wait() {
+		if (pending.valid()) pending.get();
+	}
+
+	void Flush() {
+		if (count == 0) return;
+		Wait();
+		std::swap(current, next);
+		std::size_t size = count;
+		count = 0;
+		pending = std::async(std::launch::async, [this, size]() {
+			file.write(reinterpret_cast<const char*>(next.data()), size * sizeof(int));
+		});
+	}
+};
+
+// Tournament tree over the run heads: every inner node keeps the loser of the match played
+// there and node 0 the overall winner, so taking the smallest element and replacing it costs
+// one comparison per level, log2(k) in total, instead of the 2 log2(k) of a binary heap.
+class LoserTree {
+public:
+	explicit LoserTree(std::vector<std::unique_ptr<RunReader>>& runs) : runs(runs), losers(runs.size()) {
+		std::size_t k = runs.size();
+		std::vector<std::size_t> winners(2 * k);
+		for (std::size_t index = 0; index < k; index++) winners[k + index] = index;
+		for (std::size_t node = k - 1; node > 0; node--) {
+			std::size_t a = winners[2 * node], b = winners[2 * node + 1];
+			winners[node] = Less(a, b) ? a : b;
+			losers[node] = Less(a, b) ? b : a;
+		}
+		losers[0] = k == 1 ? 0 : winners[1];
+	}
+
+	bool Empty() const {
+		return runs[losers[0]]->Empty();
+	}
+
+	int Top() const {
+		return runs[losers[0]]->Value();
+	}
+
+	void Pop() {
+		std::size_t winner = losers[0];
+		runs[winner]->Advance();
+		for (std::size_t node = (runs.size() + winner) / 2; node > 0; node /= 2) {
+			if (Less(losers[node], winner)) std::swap(losers[node], winner);
+		}
+		losers[0] = winner;
+	}
+
+private:
+	std::vector<std::unique_ptr<RunReader>>& runs;
+	std::vector<std::size_t> losers;
+
+	// Exhausted runs lose every match.
+	bool Less(std::size_t a, std::size_t b) const {
+		if (runs[a]->Empty()) return false;
+		if (runs[b]->Empty()) return true;
+		return runs[a]->Value() < runs[b]->Value() || (runs[a]->Value() == runs[b]->Value() && a < b);
+	}
+};
+
+// Removes the run files it was given when it goes out of scope, so that no run is left
+// behind when the sort fails half way.
+class TempFiles {
+public:
+	TempFiles() = default;
+	TempFiles(const TempFiles&) = delete;
+	TempFiles& operator=(const TempFiles&) = delete;
+
+	~TempFiles() {
+		for (const std::string& path : paths) Remove(path);
+	}
+
+	const std::string& Add(const std::string& path) {
+		paths.push_back(path);
+		return path;
+	}
+
+	// Removes a file early; errors are ignored, since a leftover run is harmless.
+	static void Remove(const std::string& path) {
+		std::error_code error;
+		std::filesystem::remove(path, error);
+	}
+
+private:
+	std::vector<std::string> paths;
+};
+
+// Writes a sorted chunk as one run.
+static void WriteRun(const std::string& path, const int* data, std::size_t size) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Error! Unable to open the file " + path);
+	}
+	file.write(reinterpret_cast<const char*>(data), size * sizeof(int));
+	file.close();
+	if (!file) {
+		throw std::runtime_error("Error! Unable to write the file " + path);
+	}
+}
+
+static std::string RunPath(const std::filesystem::path& temp_dir, const std::string& prefix, std::size_t pass, std::size_t index) {
+	return (temp_dir / (prefix + "." + std::to_string(pass) + "." + std::to_string(index) + ".run")).string();
+}
+
+static void MergeRuns(const std::vector<std::string>& inputs, const std::string& output, std::size_t memory_bytes) {
+	std::size_t buffer_size = std::max(min_buffer_bytes, memory_bytes / (2 * (inputs.size() + 1))) / sizeof(int);
+	std::vector<std::unique_ptr<RunReader>> runs;
+	for (const std::string& input : inputs) {
+		runs.push_back(std::make_unique<RunReader>(input, buffer_size));
+	}
+	RunWriter writer(output, buffer_size);
+	LoserTree tree(runs);
+	while (!tree.Empty()) {
+		writer.Push(tree.Top());
+		tree.Pop();
+	}
+	writer.Close();
+}
+
+void ExternalSort(const std::string& in_file, const std::string& out_file, std::size_t memory_bytes, const std::string& temp_dir) {
+	using namespace std::chrono;
+	auto start = high_resolution_clock::now();
+	std::filesystem::path temp_path = temp_dir.empty() ? std::filesystem::temp_directory_path() : std::filesystem::path(temp_dir);
+	std::string prefix = std::filesystem::path(out_file).filename().string() + "." + std::to_string(system_clock::now().time_since_epoch().count());
+	std::ifstream fin(in_file, std::ios::binary);
+	if (!fin) {
+		throw std::runtime_error("Error! Unable to open the file " + in_file);
+	}
+	if (memory_bytes < external_sort_min_memory) {
+		throw std::runtime_error("Error! The memory budget is too small");
+	}
+	TempFiles temp_files;
+
+	// The chunk being sorted, the one being read ahead, the one being written and FastSort's
+	// scratch share the memory.
+	std::size_t chunk_size = memory_bytes / (4 * sizeof(int));
+	std::vector<int> chunk(chunk_size);
+	std::vector<int> next_chunk(chunk_size);
+	std::vector<int> written_chunk(chunk_size);
+	std::future<void> pending_write;
+	auto read_chunk = [&fin](std::vector<int>& buffer) {
+		fin.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(int));
+		if (fin.gcount() % sizeof(int) != 0) {
+			throw std::runtime_error("Error! The file size is not a multiple of the int size");
+		}
+		return static_cast<std::size_t>(fin.gcount()) / sizeof(int);
+	};
+	std::vector<std::string> runs;
+	std::size_t total = 0;
+	std::size_t count = read_chunk(chunk);
+	while (count > 0) {
+		std::future<std::size_t> next_count;
+		if (count == chunk_size) {
+			next_count = std::async(std::launch::async, read_chunk, std::ref(next_chunk));
+		}
+		FastSort(chunk.data(), count);
+		// The sorted chunk is written while the next one is read and sorted.
+		if (pending_write.valid()) pending_write.get();
+		std::swap(chunk, written_chunk);
+		runs.push_back(temp_files.Add(RunPath(temp_path, prefix, 0, runs.size())));
+		pending_write = std::async(std::launch::async, WriteRun, runs.back(), written_chunk.data(), count);
+		total += count;
+		count = next_count.valid() ? next_count.get() : 0;
+		std::swap(chunk, next_chunk);
+	}
+	if (pending_write.valid()) pending_write.get();
+	chunk = std::vector<int>();
+	next_chunk = std::vector<int>();
+	written_chunk = std::vector<int>();
+
+	// One buffer per input run and one for the output, none below min_buffer_bytes.
+	std::size_t ways = std::max<std::size_t>(3, std::min(max_merge_ways, memory_bytes / (2 * min_buffer_bytes))) - 1;
+	std::size_t passes = 0;
+	while (runs.size() > ways) {
+		passes++;
+		std::vector<std::string> merged;
+		for (std::size_t first = 0; first < runs.size(); first += ways) {
+			std::vector<std::string> group(runs.begin() + first, runs.begin() + std::min(runs.size(), first + ways));
+			merged.push_back(temp_files.Add(RunPath(temp_path, prefix, passes, merged.size())));
+			MergeRuns(group, merged.back(), memory_bytes);
+			for (const std::string& run : group) TempFiles::Remove(run);
+		}
+		runs = merged;
+	}
+	std::size_t run_count = runs.size();
+	if (runs.empty()) {
+		std::ofstream(out_file, std::ios::binary);
+	}
+	else {
+		MergeRuns(runs, out_file, memory_bytes);
+	}
+	auto stop = high_resolution_clock::now();
+	std::cout << "Sorting duration in milliseconds: " << duration_cast<milliseconds>(stop - start).count() << " msec;\n"
+		<< "Elements: " << total << ";\n"
+		<< "Runs in the last merge: " << run_count << ";\n"
+		<< "Intermediate merge passes: " << passes << ";\n";
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Smallest memory budget: room for a two-way merge with buffers of the smallest useful size.
+const std::size_t external_sort_min_memory = 6 << 16;
+
+// Sorts a file of native-endian 32-bit ints that may be far larger than memory_bytes: chunks
+// that fit in memory are sorted with FastSort() and spilled as runs into temp_dir (by default
+// the system temp directory), then the runs are merged into out_file. Throws
+// std::runtime_error when a file cannot be read or written or memory_bytes is below
+// external_sort_min_memory.
+void ExternalSort(const std::string& in_file, const std::string& out_file, std::size_t memory_bytes, const std::string& temp_dir = "");
@@ -1,36 +1,171 @@
-﻿#include <iostream>
+#include <iostream>
 #include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
 
 #include "Sortings.h"
 #include "ArrayUtils.h"
+#include "Benchmark.h"
+#include "ExternalSort.h"
 
-int main() {
+static const SortingEntry sortings[] = {
+	{ "bubble", "Bubble Sort", BubbleSort },
+	{ "insertion", "Insertion Sort", InsertionSort },
+	{ "merge", "Merge Sort", MergeSort },
+	{ "quick", "Quick Sort", QuickSort },
+	{ "pdq", "Pattern-defeating Quick Sort", PdqSort },
+	{ "parallel-merge", "Parallel Merge Sort", ParallelMergeSort },
+	{ "parallel-quick", "Parallel Quick Sort", ParallelQuickSort },
+	{ "radix", "Radix Sort", RadixSort },
+	{ "parallel-radix", "Parallel Radix Sort", ParallelRadixSort }
+};
+
+static std::vector<std::string> SplitList(const std::string& list) {
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		if (!item.empty()) items.push_back(item);
+	}
+	return items;
+}
+
+static const char* const benchmark_usage =
+	"Usage: MySortings --benchmark [--algorithms a,b] [--sizes n,m] [--distributions d,e] [--warmups n]\n"
+	"       [--repeats n] [--seed n] [--time-limit ms] [--format csv|json] [--output file]\n";
+
+// Throws on a bad option; main() reports it with the usage.
+static int Benchmark(int argc, char* argv[]) {
+	BenchmarkOptions options;
+	std::string output;
+	for (int index = 2; index < argc; index++) {
+		std::string arg = argv[index];
+		if (index + 1 >= argc) {
+			throw std::runtime_error("Error! Missing value for " + arg);
+		}
+		std::string value = argv[++index];
+		if (arg == "--algorithms") {
+			for (const std::string& key : SplitList(value)) {
+				const SortingEntry* found = std::find_if(std::begin(sortings), std::end(sortings), [&key](const SortingEntry& entry) { return key == entry.key; });
+				if (found == std::end(sortings)) {
+					throw std::runtime_error("Error! Unknown algorithm " + key);
+				}
+				options.sortings.push_back(found);
+			}
+		}
+		else if (arg == "--sizes") {
+			options.sizes.clear();
+			for (const std::string& size : SplitList(value)) options.sizes.push_back(std::stoull(size));
+		}
+		else if (arg == "--distributions") {
+			options.distributions.clear();
+			for (const std::string& name : SplitList(value)) options.distributions.push_back(ParseDistribution(name));
+		}
+		else if (arg == "--warmups") options.warmups = std::stoull(value);
+		else if (arg == "--repeats") options.repeats = std::stoull(value);
+		else if (arg == "--seed") options.seed = std::stoull(value);
+		else if (arg == "--time-limit") options.time_limit_ms = std::stod(value);
+		else if (arg == "--format") {
+			if (value != "csv" && value != "json") {
+				throw std::runtime_error("Error! Unknown format " + value);
+			}
+			options.json = value == "json";
+		}
+		else if (arg == "--output") output = value;
+		else throw std::runtime_error("Error! Unknown option " + arg);
+	}
+	if (options.sortings.empty()) {
+		for (const SortingEntry& entry : sortings) options.sortings.push_back(&entry);
+	}
+	if (output.empty()) {
+		RunBenchmark(options, std::cout);
+		return 0;
+	}
+	std::ofstream fout(output);
+	if (!fout) {
+		throw std::runtime_error("Error! Unable to open the file " + output);
+	}
+	RunBenchmark(options, fout);
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc > 1 && std::strcmp(argv[1], "--benchmark") == 0) {
+		std::string error;
+		try {
+			return Benchmark(argc, argv);
+		}
+		// std::stoull and friends report bad numbers with their own name only.
+		catch (const std::logic_error&) {
+			error = "Error! Invalid number";
+		}
+		catch (const std::exception& exception) {
+			error = exception.what();
+		}
+		std::cout << error << "\n" << benchmark_usage;
+		return 1;
+	}
+	// MySortings --external <input> <output> [memory in MiB] [temp directory]
+	if (argc > 1 && std::strcmp(argv[1], "--external") == 0) {
+		if (argc < 4) {
+			std::cout << "Usage: MySortings --external <input> <output> [memory in MiB] [temp directory]\n";
+			return 1;
+		}
+		std::size_t memory_mib = argc > 4 ? std::stoul(argv[4]) : 256;
+		if ((memory_mib << 20) < external_sort_min_memory) {
+			std::cout << "Error! The memory budget must be at least " << ((external_sort_min_memory + (1 << 20) - 1) >> 20) << " MiB\n"
+				<< "Usage: MySortings --external <input> <output> [memory in MiB] [temp directory]\n";
+			return 1;
+		}
+		// Caught here so that the temporary runs are removed on the way out.
+		try {
+			ExternalSort(argv[2], argv[3], memory_mib << 20, argc > 5 ? argv[5] : "");
+		}
+		catch (const std::exception& error) {
+			std::cout << error.what() << "\n";
+			return 1;
+		}
+		return 0;
+	}
 	bool finish = false;
 	while (!finish) {
-		ArrayTypeChoice type;
+		ArrayTypeChoice type = ArrayTypeChoice::random;
 		std::size_t array_size = 0;
-		char choice = '0';
+		int choice = 0;
 		std::cout << "Enter the size of array: ";
 		std::cin >> array_size;
-		std::cout << "Choose the data type you want the array to be filled with:\n1)Random;\n2)Ascending order;\n3)Descending order;\nEnter 1, 2 or 3 to make a choice: ";
-		std::cin >> choice;
+		std::cout << "Choose the data type you want the array to be filled with:\n1)Random;\n2)Ascending order;\n3)Descending order;\n4)Few unique values;\n5)Organ pipe;\n6)Sawtooth;\n7)Random over the whole int range;\n8)Almost sorted;\n9)Normally distributed;\n10)All equal;\nEnter 1 to 10 to make a choice: ";
+		if (!(std::cin >> choice)) {
+			std::cin.clear();
+			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		}
 		switch (choice) {
-		case '1': type = ArrayTypeChoice::random; break;
-		case '2': type = ArrayTypeChoice::asc_order; break;
-		case '3': type = ArrayTypeChoice::desc_order;
+		case 1: type = ArrayTypeChoice::random; break;
+		case 2: type = ArrayTypeChoice::asc_order; break;
+		case 3: type = ArrayTypeChoice::desc_order; break;
+		case 4: type = ArrayTypeChoice::few_unique; break;
+		case 5: type = ArrayTypeChoice::organ_pipe; break;
+		case 6: type = ArrayTypeChoice::sawtooth; break;
+		case 7: type = ArrayTypeChoice::full_range; break;
+		case 8: type = ArrayTypeChoice::almost_sorted; break;
+		case 9: type = ArrayTypeChoice::normal; break;
+		case 10: type = ArrayTypeChoice::all_equal; break;
+		default: std::cout << "Unknown choice, the array is filled with random values.\n";
 		}
 		std::unique_ptr<int[]> array0 = CreateArray(array_size, type);
-		std::unique_ptr<int[]> array1 = CreateArray(array_size, ArrayTypeChoice::copy, array0.get());
-		std::unique_ptr<int[]> array2 = CreateArray(array_size, ArrayTypeChoice::copy, array0.get());
-		std::unique_ptr<int[]> array3 = CreateArray(array_size, ArrayTypeChoice::copy, array0.get());
-		std::cout << "Bubble Sort\n";
-		BubbleSort(array0.get(), array_size);
-		std::cout << "Insertion Sort\n";
-		InsertionSort(array1.get(), array_size);
-		std::cout << "Merge Sort\n";
-		MergeSort(array2.get(), array_size);
-		std::cout << "Quick Sort\n";
-		QuickSort(array3.get(), array_size);
+		for (const auto& sorting : sortings) {
+			std::unique_ptr<int[]> array = CreateArray(array_size, ArrayTypeChoice::copy, array0.get());
+			std::cout << sorting.name << "\n";
+			sorting.sort(array.get(), array_size);
+		}
 		char answer = 'a';
 		std::cout << "Repeat? (y/n) "; std::cin >> answer;
 		if (answer == 'n') finish = true;
@@ -0,0 +1,75 @@
+#include "PerfCounters.h"
+
+#if defined(SORTINGS_PERF_COUNTERS) && defined(__linux__)
+
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const std::uint64_t perf_events[] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES };
+
+// The events form one group led by the cycle counter, so they are scheduled onto the PMU
+// together and enabled and disabled at once.
+PerfCounters::PerfCounters() {
+	for (int index = 0; index < event_count; index++) {
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = perf_events[index];
+		attr.disabled = index == 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		int group = index == 0 ? -1 : fds[0];
+		fds[index] = index == 0 || fds[0] >= 0 ? static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0)) : -1;
+	}
+}
+
+PerfCounters::~PerfCounters() {
+	for (int fd : fds) {
+		if (fd >= 0) close(fd);
+	}
+}
+
+void PerfCounters::Start() {
+	if (fds[0] < 0) return;
+	ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+HardwareCounts PerfCounters::Stop() {
+	HardwareCounts counts;
+	if (fds[0] < 0) return counts;
+	ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	std::uint64_t values[event_count] = {};
+	counts.valid = true;
+	for (int index = 0; index < event_count; index++) {
+		if (fds[index] < 0 || read(fds[index], &values[index], sizeof(values[index])) != sizeof(values[index])) counts.valid = false;
+	}
+	counts.cycles = values[0];
+	counts.instructions = values[1];
+	counts.branch_misses = values[2];
+	counts.cache_misses = values[3];
+	return counts;
+}
+
+#else
+
+PerfCounters::PerfCounters() {
+	for (int& fd : fds) fd = -1;
+}
+
+PerfCounters::~PerfCounters() {
+}
+
+void PerfCounters::Start() {
+}
+
+HardwareCounts PerfCounters::Stop() {
+	return HardwareCounts();
+}
+
+#endif
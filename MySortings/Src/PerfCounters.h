@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// Built with -DSORTINGS_PERF_COUNTERS (the PERF_COUNTERS CMake option), the sortings read the
+// hardware counters below around every call. Only Linux has perf_event_open.
+#if defined(SORTINGS_PERF_COUNTERS) && defined(__linux__)
+constexpr bool perf_counters_enabled = true;
+#else
+constexpr bool perf_counters_enabled = false;
+#endif
+
+struct HardwareCounts {
+	std::uint64_t cycles = 0;
+	std::uint64_t instructions = 0;
+	std::uint64_t branch_misses = 0;
+	std::uint64_t cache_misses = 0;
+	// False when the counters could not be opened, e.g. with perf_event_paranoid too strict.
+	bool valid = false;
+};
+
+// Counts user-space events of the calling thread only, so for the parallel sortings the
+// work done by the pool workers is not included.
+class PerfCounters {
+public:
+	PerfCounters();
+	~PerfCounters();
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	void Start();
+	HardwareCounts Stop();
+
+private:
+	static const int event_count = 4;
+	int fds[event_count];
+};
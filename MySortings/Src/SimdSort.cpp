@@ -0,0 +1,247 @@
+#include "SimdSort.h"
+
+#include <algorithm>
+#include <climits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Every vector width provides the same few operations: element-wise Min/Max and comparison,
+// Reverse of the lanes, Sort of one register and Cleanup, which sorts a register holding a bitonic sequence
+// (one that rises then falls, or the other way round). The networks below are written once on
+// top of them.
+
+#if defined(__AVX2__)
+struct SimdLanes {
+	using Type = __m256i;
+	static const int lanes = 8;
+
+	static Type Load(const int* source) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source)); }
+	static void Store(int* target, Type v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(target), v); }
+	static Type Min(Type a, Type b) { return _mm256_min_epi32(a, b); }
+	static Type Max(Type a, Type b) { return _mm256_max_epi32(a, b); }
+	static Type Reverse(Type v) { return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0)); }
+	static Type Broadcast(int value) { return _mm256_set1_epi32(value); }
+	static Type Greater(Type a, Type b) { return _mm256_cmpgt_epi32(a, b); }
+	static Type Or(Type a, Type b) { return _mm256_or_si256(a, b); }
+	static bool Any(Type mask) { return _mm256_movemask_epi8(mask) != 0; }
+
+	// Compares every lane with its partner p and keeps the maximum in the lanes set in mask.
+	template <int mask>
+	static Type Exchange(Type v, Type p) { return _mm256_blend_epi32(Min(v, p), Max(v, p), mask); }
+
+	static Type Cleanup(Type v) {
+		return CleanupQuarters(Exchange<0xF0>(v, _mm256_permute2x128_si256(v, v, 1)));
+	}
+
+	// Sorts pairs, merges them into sorted quarters, then merges the halves by comparing every
+	// lane with its mirror image.
+	static Type Sort(Type v) {
+		v = Exchange<0xAA>(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+		v = Exchange<0xCC>(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+		v = Exchange<0xAA>(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return CleanupQuarters(Exchange<0xF0>(v, Reverse(v)));
+	}
+
+	static Type CleanupQuarters(Type v) {
+		v = Exchange<0xCC>(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return Exchange<0xAA>(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	}
+};
+#elif defined(__SSE2__)
+struct SimdLanes {
+	using Type = __m128i;
+	static const int lanes = 4;
+
+	static Type Load(const int* source) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(source)); }
+	static void Store(int* target, Type v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(target), v); }
+	// SSE2 has no 32-bit min/max, so they go through a compare and a select.
+	static Type Select(Type mask, Type a, Type b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+	static Type Min(Type a, Type b) { return Select(_mm_cmpgt_epi32(a, b), b, a); }
+	static Type Max(Type a, Type b) { return Select(_mm_cmpgt_epi32(a, b), a, b); }
+	static Type Reverse(Type v) { return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)); }
+	static Type Broadcast(int value) { return _mm_set1_epi32(value); }
+	static Type Greater(Type a, Type b) { return _mm_cmpgt_epi32(a, b); }
+	static Type Or(Type a, Type b) { return _mm_or_si128(a, b); }
+	static bool Any(Type mask) { return _mm_movemask_epi8(mask) != 0; }
+
+	template <int mask>
+	static Type Exchange(Type v, Type p) {
+		const Type select = _mm_setr_epi32(mask & 1 ? -1 : 0, mask & 2 ? -1 : 0, mask & 4 ? -1 : 0, mask & 8 ? -1 : 0);
+		return Select(select, Max(v, p), Min(v, p));
+	}
+
+	static Type Cleanup(Type v) {
+		v = Exchange<0xC>(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return Exchange<0xA>(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	}
+
+	static Type Sort(Type v) {
+		v = Exchange<0xA>(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+		v = Exchange<0xC>(v, Reverse(v));
+		return Exchange<0xA>(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	}
+};
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+using Vector = SimdLanes::Type;
+
+// Sorts the bitonic sequence held in regs[0, count): half-cleaners between whole registers
+// first, then inside every register.
+static void CleanupRegisters(Vector* regs, int count) {
+	for (int distance = count / 2; distance > 0; distance /= 2) {
+		for (int block = 0; block < count; block += 2 * distance) {
+			for (int index = block; index < block + distance; index++) {
+				Vector low = SimdLanes::Min(regs[index], regs[index + distance]);
+				regs[index + distance] = SimdLanes::Max(regs[index], regs[index + distance]);
+				regs[index] = low;
+			}
+		}
+	}
+	for (int index = 0; index < count; index++) {
+		regs[index] = SimdLanes::Cleanup(regs[index]);
+	}
+}
+
+// Merges the sorted runs regs[0, count / 2) and regs[count / 2, count). Comparing every element
+// of the first run with its mirror in the second splits them into a lower and an upper half,
+// both bitonic; the upper one is stored reversed, which keeps it bitonic.
+static void MergeRegisters(Vector* regs, int count) {
+	int half = count / 2;
+	for (int index = 0; index < half; index++) {
+		Vector a = regs[index];
+		Vector b = SimdLanes::Reverse(regs[count - 1 - index]);
+		regs[index] = SimdLanes::Min(a, b);
+		regs[count - 1 - index] = SimdLanes::Reverse(SimdLanes::Max(a, b));
+	}
+	CleanupRegisters(regs, half);
+	CleanupRegisters(regs + half, half);
+}
+
+void SortBlock(int* arr, std::size_t size) {
+	const int lanes = SimdLanes::lanes;
+	int count = 1;
+	while (static_cast<std::size_t>(count * lanes) < size) count *= 2;
+	int buffer[simd_block_size];
+	std::copy(arr, arr + size, buffer);
+	// The padding sorts to the end and is dropped.
+	std::fill(buffer + size, buffer + count * lanes, INT_MAX);
+	Vector regs[simd_block_size / lanes];
+	for (int index = 0; index < count; index++) {
+		regs[index] = SimdLanes::Sort(SimdLanes::Load(buffer + index * lanes));
+	}
+	for (int run = 1; run < count; run *= 2) {
+		for (int start = 0; start < count; start += 2 * run) {
+			MergeRegisters(regs + start, 2 * run);
+		}
+	}
+	for (int index = 0; index < count; index++) {
+		SimdLanes::Store(buffer + index * lanes, regs[index]);
+	}
+	std::copy(buffer, buffer + size, arr);
+}
+
+// Scalar merge for the tails, taking from a first on ties.
+static int* MergeScalar(const int* a, const int* a_end, const int* b, const int* b_end, int* out) {
+	while (a != a_end && b != b_end) {
+		*out++ = *b < *a ? *b++ : *a++;
+	}
+	out = std::copy(a, a_end, out);
+	return std::copy(b, b_end, out);
+}
+
+// Keeps one register of the larger elements; every step merges it with the next register of
+// the input whose head is smaller and writes out the lower register.
+void MergeRuns(const int* a, std::size_t a_size, const int* b, std::size_t b_size, int* out) {
+	const int lanes = SimdLanes::lanes;
+	const int* a_end = a + a_size;
+	const int* b_end = b + b_size;
+	if (a_size < static_cast<std::size_t>(lanes) || b_size < static_cast<std::size_t>(lanes)) {
+		MergeScalar(a, a_end, b, b_end, out);
+		return;
+	}
+	Vector regs[2] = { SimdLanes::Load(a), SimdLanes::Load(b) };
+	a += lanes;
+	b += lanes;
+	while (a_end - a >= lanes && b_end - b >= lanes) {
+		MergeRegisters(regs, 2);
+		SimdLanes::Store(out, regs[0]);
+		out += lanes;
+		if (*b < *a) {
+			regs[0] = SimdLanes::Load(b);
+			b += lanes;
+		}
+		else {
+			regs[0] = SimdLanes::Load(a);
+			a += lanes;
+		}
+	}
+	MergeRegisters(regs, 2);
+	SimdLanes::Store(out, regs[0]);
+	out += lanes;
+	// The register still held and the shorter tail (under a register long) are merged first,
+	// then the result with the other tail.
+	int high[simd_block_size / 2];
+	int rest[simd_block_size];
+	SimdLanes::Store(high, regs[1]);
+	if (b_end - b < lanes) {
+		int* rest_end = MergeScalar(high, high + lanes, b, b_end, rest);
+		MergeScalar(rest, rest_end, a, a_end, out);
+	}
+	else {
+		int* rest_end = MergeScalar(a, a_end, high, high + lanes, rest);
+		MergeScalar(rest, rest_end, b, b_end, out);
+	}
+}
+
+// Compares four registers with the threshold per step and only looks for the exact position
+// in the step that found something.
+std::size_t FindGreater(const int* arr, std::size_t size, int threshold) {
+	const std::size_t lanes = SimdLanes::lanes;
+	const Vector limit = SimdLanes::Broadcast(threshold);
+	std::size_t index = 0;
+	for (; index + 4 * lanes <= size; index += 4 * lanes) {
+		Vector found = SimdLanes::Or(
+			SimdLanes::Or(SimdLanes::Greater(SimdLanes::Load(arr + index), limit), SimdLanes::Greater(SimdLanes::Load(arr + index + lanes), limit)),
+			SimdLanes::Or(SimdLanes::Greater(SimdLanes::Load(arr + index + 2 * lanes), limit), SimdLanes::Greater(SimdLanes::Load(arr + index + 3 * lanes), limit)));
+		if (SimdLanes::Any(found)) break;
+	}
+	for (; index < size; index++) {
+		if (arr[index] > threshold) return index;
+	}
+	return size;
+}
+#else
+void SortBlock(int* arr, std::size_t size) {
+	for (std::size_t index1 = 1; index1 < size; index1++) {
+		int value = arr[index1];
+		std::size_t index2 = index1;
+		while (index2 > 0 && arr[index2 - 1] > value) {
+			arr[index2] = arr[index2 - 1];
+			index2--;
+		}
+		arr[index2] = value;
+	}
+}
+
+void MergeRuns(const int* a, std::size_t a_size, const int* b, std::size_t b_size, int* out) {
+	const int* a_end = a + a_size;
+	const int* b_end = b + b_size;
+	while (a != a_end && b != b_end) {
+		*out++ = *b < *a ? *b++ : *a++;
+	}
+	out = std::copy(a, a_end, out);
+	std::copy(b, b_end, out);
+}
+
+std::size_t FindGreater(const int* arr, std::size_t size, int threshold) {
+	for (std::size_t index = 0; index < size; index++) {
+		if (arr[index] > threshold) return index;
+	}
+	return size;
+}
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+// Largest range SortBlock() accepts.
+const std::size_t simd_block_size = 64;
+
+// True when the kernels below are vectorized (AVX2, or SSE2 with half the width); without
+// either they fall back to insertion sort and a plain merge.
+#if defined(__AVX2__) || defined(__SSE2__)
+const bool simd_sort_enabled = true;
+#else
+const bool simd_sort_enabled = false;
+#endif
+
+// Sorts up to simd_block_size ints with a bitonic sorting network held in vector registers.
+void SortBlock(int* arr, std::size_t size);
+
+// Merges two sorted runs into out, which must not overlap them, a vector of elements at a time.
+void MergeRuns(const int* a, std::size_t a_size, const int* b, std::size_t b_size, int* out);
+
+// Returns the index of the first of the size ints that is greater than threshold, or size.
+std::size_t FindGreater(const int* arr, std::size_t size, int threshold);
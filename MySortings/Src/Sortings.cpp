@@ -1,92 +1,801 @@
 #include "Sortings.h"
+#include "SimdSort.h"
+#include "ThreadPool.h"
 
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Built with -DSORTINGS_NO_OPERATION_COUNTS (COUNT_OPERATIONS=OFF in CMake), the comparison
+// and insertion counters compile to nothing, so the timings show the cost of the sorting alone.
+#ifdef SORTINGS_NO_OPERATION_COUNTS
+struct Counter {
+	Counter& operator++() { return *this; }
+	Counter& operator++(int) { return *this; }
+	Counter& operator+=(std::size_t) { return *this; }
+	operator std::size_t() const { return 0; }
+};
+#else
+using Counter = std::size_t;
+#endif
 
 struct Metrics {
-	std::chrono::milliseconds sec_time;
-	std::size_t comparison_number = 0;
-	std::size_t insertion_number = 0;
+	std::chrono::nanoseconds time{};
+	Counter comparison_number{};
+	Counter insertion_number{};
+	HardwareCounts hardware;
 };
 
+static PerfCounters& GetPerfCounters() {
+	static PerfCounters counters;
+	return counters;
+}
+
+static std::chrono::high_resolution_clock::time_point StartMeasure() {
+	if (perf_counters_enabled) GetPerfCounters().Start();
+	return std::chrono::high_resolution_clock::now();
+}
+
+static void StopMeasure(Metrics& m, std::chrono::high_resolution_clock::time_point start) {
+	auto stop = std::chrono::high_resolution_clock::now();
+	if (perf_counters_enabled) m.hardware = GetPerfCounters().Stop();
+	m.time = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
+}
+
 static bool IsSorted(int* arr, std::size_t size) {
 	std::size_t index = 1;
-	while (index < size - 1) {
+	while (index < size) {
 		if (arr[index] < arr[index - 1]) return false;
 		index++;
 	}
 	return true;
 }
 
+static SortReport* sort_report = nullptr;
+
+void SetSortReport(SortReport* report) {
+	sort_report = report;
+}
+
 static void PrintMetrics(Metrics m, int* arr, std::size_t size) {
-	std::cout << "Sorting duration in milliseconds: " << m.sec_time.count() << " msec;\n"
+	if (sort_report) {
+		sort_report->time = m.time;
+		sort_report->comparisons = m.comparison_number;
+		sort_report->moves = m.insertion_number;
+		sort_report->sorted = IsSorted(arr, size);
+		sort_report->hardware = m.hardware;
+		return;
+	}
+	std::cout << "Sorting duration in milliseconds: " << std::chrono::duration_cast<std::chrono::milliseconds>(m.time).count() << " msec;\n"
 		<< "Data comparisons: " << m.comparison_number << ";\n"
-		<< "Data insertions: " << m.insertion_number << ";\n"
+		<< "Data insertions: " << m.insertion_number << ";\n";
+	if (m.hardware.valid) {
+		std::cout << "CPU cycles: " << m.hardware.cycles << ";\n"
+			<< "Instructions: " << m.hardware.instructions << ";\n"
+			<< "Branch misses: " << m.hardware.branch_misses << ";\n"
+			<< "Cache misses: " << m.hardware.cache_misses << ";\n";
+	}
+	std::cout
 		<< "Is array fully sorted: ";
 	if (IsSorted(arr, size)) std::cout << "yes\n";
 	else std::cout << "no\n";
 }
 
-static void MSMerge(int* arr, int* temp_arr, std::size_t s_index, std::size_t m_index, std::size_t e_index, Metrics& ms_m) {
-	std::size_t temp_s_i = s_index;
-	std::size_t temp_m_i = m_index;
-	std::size_t index = 0;
-	while (temp_s_i < m_index && temp_m_i < e_index) {
+// Natural runs shorter than this are extended by insertion sort before merging starts.
+static const std::size_t ms_min_run = 32;
+// After this many wins in a row from one side the merge switches to galloping.
+static const std::size_t ms_min_gallop = 7;
+
+// Finds the run starting at s_index and returns its end: an ascending run is kept, a strictly
+// descending one reversed, and one shorter than ms_min_run extended by insertion sort.
+static std::size_t MSNextRun(int* arr, std::size_t s_index, std::size_t size, Metrics& ms_m) {
+	std::size_t e_index = s_index + 1;
+	if (e_index < size && arr[e_index] < arr[s_index]) {
+		while (e_index < size && arr[e_index] < arr[e_index - 1]) e_index++;
+		std::reverse(arr + s_index, arr + e_index);
+		ms_m.insertion_number += e_index - s_index;
+	}
+	else {
+		while (e_index < size && !(arr[e_index] < arr[e_index - 1])) e_index++;
+	}
+	ms_m.comparison_number += e_index - s_index;
+	if (e_index - s_index < ms_min_run) {
+		std::size_t forced = std::min(size, s_index + ms_min_run);
+		for (std::size_t index1 = e_index; index1 < forced; index1++) {
+			int value = arr[index1];
+			std::size_t index2 = index1;
+			while (index2 > s_index && value < arr[index2 - 1]) {
+				arr[index2] = arr[index2 - 1];
+				index2--;
+				ms_m.comparison_number++;
+				ms_m.insertion_number++;
+			}
+			ms_m.comparison_number++;
+			arr[index2] = value;
+			ms_m.insertion_number++;
+		}
+		e_index = forced;
+	}
+	return e_index;
+}
+
+// Exponential search: the first element of [first, last) for which before() is false, where
+// before() holds for a prefix of the range. Costs O(log k) for an answer k elements in.
+template <class Before>
+static const int* MSGallop(const int* first, const int* last, Before before, Metrics& ms_m) {
+	std::size_t size = last - first;
+	std::size_t low = 0, high = 1;
+	while (high <= size && before(first[high - 1])) {
 		ms_m.comparison_number++;
-		if (arr[temp_s_i] <= arr[temp_m_i]) temp_arr[index++] = arr[temp_s_i++];
-		else temp_arr[index++] = arr[temp_m_i++];
+		low = high;
+		high = 2 * high + 1;
 	}
-	if (temp_s_i == m_index) {
-		while (temp_m_i < e_index) {
-			temp_arr[index++] = arr[temp_m_i++];
+	high = std::min(high, size);
+	return std::partition_point(first + low, first + high, [&](int value) {
+		ms_m.comparison_number++;
+		return before(value);
+	});
+}
+
+// Stable merge into out. Once one side has won ms_min_gallop times in a row, the rest of its
+// winning stretch is found by galloping and copied as a block, so merging runs that barely
+// interleave costs close to O(log n) comparisons.
+static void MSMerge(const int* a, const int* a_end, const int* b, const int* b_end, int* out, Metrics& ms_m) {
+	ms_m.insertion_number += (a_end - a) + (b_end - b);
+	std::size_t a_wins = 0, b_wins = 0;
+	while (a != a_end && b != b_end) {
+		ms_m.comparison_number++;
+		// Written without branches: on random data the winner is a coin toss.
+		bool take_b = *b < *a;
+		*out++ = take_b ? *b : *a;
+		b += take_b;
+		a += !take_b;
+		b_wins = take_b ? b_wins + 1 : 0;
+		a_wins = take_b ? 0 : a_wins + 1;
+		if (a_wins >= ms_min_gallop && a != a_end && b != b_end) {
+			int key = *b;
+			const int* stop = MSGallop(a, a_end, [key](int value) { return !(key < value); }, ms_m);
+			out = std::copy(a, stop, out);
+			a = stop;
+			a_wins = 0;
+		}
+		else if (b_wins >= ms_min_gallop && a != a_end && b != b_end) {
+			int key = *a;
+			const int* stop = MSGallop(b, b_end, [key](int value) { return value < key; }, ms_m);
+			out = std::copy(b, stop, out);
+			b = stop;
+			b_wins = 0;
 		}
 	}
-	else {
-		while (temp_s_i < m_index) {
-			temp_arr[index++] = arr[temp_s_i++];
+	out = std::copy(a, a_end, out);
+	std::copy(b, b_end, out);
+}
+
+// A sorted run [s_index, e_index), stored in arr or in the scratch buffer.
+struct MSRun {
+	std::size_t s_index;
+	std::size_t e_index;
+	std::size_t merges;
+	bool in_scratch;
+};
+
+// Merges run b into the run a right before it, from the buffer they are in into the other one.
+static void MSMergeRuns(int* arr, int* scratch_arr, MSRun& a, const MSRun& b, Metrics& ms_m) {
+	if (a.in_scratch != b.in_scratch) {
+		const int* source = b.in_scratch ? scratch_arr : arr;
+		std::copy(source + b.s_index, source + b.e_index, (a.in_scratch ? scratch_arr : arr) + b.s_index);
+		ms_m.insertion_number += b.e_index - b.s_index;
+	}
+	const int* from = a.in_scratch ? scratch_arr : arr;
+	int* to = a.in_scratch ? arr : scratch_arr;
+	MSMerge(from + a.s_index, from + a.e_index, from + b.s_index, from + b.e_index, to + a.s_index, ms_m);
+	a.e_index = b.e_index;
+	a.merges = std::max(a.merges, b.merges) + 1;
+	a.in_scratch = !a.in_scratch;
+}
+
+// Natural merge sort. Runs are merged like a binary counter: two runs are merged as soon as they
+// went through the same number of merges, which keeps the merges balanced, keeps both in the same
+// buffer and the run stack under 64 entries. Every merge goes from one buffer into the other, so
+// nothing is copied back until the end, and then at most once.
+static void MSSort(int* arr, int* scratch_arr, std::size_t size, Metrics& ms_m) {
+	MSRun runs[66];
+	std::size_t top = 0;
+	std::size_t s_index = 0;
+	while (s_index < size) {
+		std::size_t e_index = MSNextRun(arr, s_index, size, ms_m);
+		runs[top++] = { s_index, e_index, 0, false };
+		while (top >= 2 && runs[top - 2].merges == runs[top - 1].merges) {
+			MSMergeRuns(arr, scratch_arr, runs[top - 2], runs[top - 1], ms_m);
+			top--;
 		}
+		s_index = e_index;
 	}
-	for (std::size_t i = 0; i < index; i++) {
-		ms_m.insertion_number++;
-		arr[s_index + i] = temp_arr[i];
+	while (top >= 2) {
+		MSMergeRuns(arr, scratch_arr, runs[top - 2], runs[top - 1], ms_m);
+		top--;
+	}
+	if (top == 1 && runs[0].in_scratch) {
+		std::copy(scratch_arr, scratch_arr + size, arr);
+		ms_m.insertion_number += size;
 	}
 }
 
-static void MSSplit(int* arr, int* temp_arr, std::size_t s_index, std::size_t e_index, Metrics& ms_m) {
-	if (s_index == e_index || s_index == e_index - 1) return;
-	std::size_t m_index = (e_index + s_index) / 2;
-	MSSplit(arr, temp_arr, s_index, m_index, ms_m);
-	MSSplit(arr, temp_arr, m_index, e_index, ms_m);
-	MSMerge(arr, temp_arr, s_index, m_index, e_index, ms_m);
+// Ranges of at most this many elements are finished by insertion sort.
+static const std::size_t qs_insertion_cutoff = 16;
+// From this size on the pivot is the ninther (median of three medians of three).
+static const std::size_t qs_ninther_threshold = 128;
+
+static void QSSort3(int* arr, std::size_t a, std::size_t b, std::size_t c, Metrics& qs_m) {
+	qs_m.comparison_number += 3;
+	if (arr[b] < arr[a]) { std::swap(arr[a], arr[b]); qs_m.insertion_number += 2; }
+	if (arr[c] < arr[b]) { std::swap(arr[b], arr[c]); qs_m.insertion_number += 2; }
+	if (arr[b] < arr[a]) { std::swap(arr[a], arr[b]); qs_m.insertion_number += 2; }
 }
 
-static std::size_t QSDevide(int* arr, std::size_t s_index, std::size_t e_index, Metrics& qs_m) {
-	std::size_t pivot = arr[(s_index + e_index) / 2];
+// Moves the pivot to the middle of [s_index, e_index], so that it is never the last element.
+static void QSChoosePivot(int* arr, std::size_t s_index, std::size_t e_index, Metrics& qs_m) {
+	std::size_t size = e_index - s_index + 1;
+	std::size_t m_index = s_index + (e_index - s_index) / 2;
+	if (size >= qs_ninther_threshold) {
+		std::size_t step = size / 8;
+		QSSort3(arr, s_index, s_index + step, s_index + 2 * step, qs_m);
+		QSSort3(arr, m_index - step, m_index, m_index + step, qs_m);
+		QSSort3(arr, e_index - 2 * step, e_index - step, e_index, qs_m);
+		QSSort3(arr, s_index + step, m_index, e_index - step, qs_m);
+	}
+	else {
+		QSSort3(arr, s_index, m_index, e_index, qs_m);
+	}
+}
+
+// Hoare partition around the value of the middle element: returns p such that
+// [s_index, p] <= pivot <= [p + 1, e_index], with p < e_index.
+static std::size_t QSPartition(int* arr, std::size_t s_index, std::size_t e_index, Metrics& qs_m) {
+	int pivot = arr[s_index + (e_index - s_index) / 2];
 	std::size_t temp_s_i = s_index;
 	std::size_t temp_e_i = e_index;
 	while (true) {
 		while (arr[temp_s_i] < pivot) { qs_m.comparison_number++; temp_s_i += 1; }
 		while (arr[temp_e_i] > pivot) { qs_m.comparison_number++; temp_e_i -= 1; }
+		qs_m.comparison_number += 2;
 		if (temp_s_i >= temp_e_i) return temp_e_i;
 		std::swap(arr[temp_s_i++], arr[temp_e_i--]);
 		qs_m.insertion_number += 2;
 	}
 }
 
-static void QSSort(int* arr, std::size_t s_index, std::size_t e_index, Metrics& qs_m) {
-	if (s_index < e_index) {
+static std::size_t QSDevide(int* arr, std::size_t s_index, std::size_t e_index, Metrics& qs_m) {
+	QSChoosePivot(arr, s_index, e_index, qs_m);
+	return QSPartition(arr, s_index, e_index, qs_m);
+}
+
+static void QSInsertionSort(int* arr, std::size_t s_index, std::size_t e_index, Metrics& qs_m) {
+	for (std::size_t index1 = s_index + 1; index1 <= e_index; index1++) {
+		int value = arr[index1];
+		std::size_t index2 = index1;
+		while (index2 > s_index && arr[index2 - 1] > value) {
+			qs_m.comparison_number++;
+			qs_m.insertion_number++;
+			arr[index2] = arr[index2 - 1];
+			index2--;
+		}
+		qs_m.comparison_number++;
+		arr[index2] = value;
+		qs_m.insertion_number++;
+	}
+}
+
+// Ranges of at most this many elements are finished by the SortBlock() network, or by
+// insertion sort in builds without vector kernels.
+static const std::size_t qs_leaf_size = simd_sort_enabled ? simd_block_size : qs_insertion_cutoff;
+
+// The vector kernels only count the elements they store.
+static void QSSortLeaf(int* arr, std::size_t s_index, std::size_t e_index, Metrics& qs_m) {
+	if (simd_sort_enabled) {
+		SortBlock(arr + s_index, e_index - s_index + 1);
+		qs_m.insertion_number += e_index - s_index + 1;
+	}
+	else {
+		QSInsertionSort(arr, s_index, e_index, qs_m);
+	}
+}
+
+static void QSSiftDown(int* arr, std::size_t root, std::size_t size, Metrics& qs_m) {
+	int value = arr[root];
+	while (2 * root + 1 < size) {
+		std::size_t child = 2 * root + 1;
+		if (child + 1 < size) {
+			qs_m.comparison_number++;
+			if (arr[child] < arr[child + 1]) child++;
+		}
+		qs_m.comparison_number++;
+		if (arr[child] <= value) break;
+		arr[root] = arr[child];
+		qs_m.insertion_number++;
+		root = child;
+	}
+	arr[root] = value;
+	qs_m.insertion_number++;
+}
+
+static void QSHeapSort(int* arr, std::size_t s_index, std::size_t e_index, Metrics& qs_m) {
+	int* heap = arr + s_index;
+	std::size_t size = e_index - s_index + 1;
+	for (std::size_t root = size / 2; root-- > 0;) {
+		QSSiftDown(heap, root, size, qs_m);
+	}
+	for (std::size_t end = size - 1; end > 0; end--) {
+		std::swap(heap[0], heap[end]);
+		qs_m.insertion_number += 2;
+		QSSiftDown(heap, 0, end, qs_m);
+	}
+}
+
+// Introsort: recurses into the smaller half and loops on the larger one, so the stack stays
+// O(log n), and falls back to heapsort once depth_limit partitions did not shrink the range enough.
+static void QSSort(int* arr, std::size_t s_index, std::size_t e_index, std::size_t depth_limit, Metrics& qs_m) {
+	while (e_index - s_index + 1 > qs_leaf_size) {
+		if (depth_limit == 0) {
+			QSHeapSort(arr, s_index, e_index, qs_m);
+			return;
+		}
+		depth_limit--;
 		std::size_t p_index = QSDevide(arr, s_index, e_index, qs_m);
-		QSSort(arr, s_index, p_index, qs_m);
-		QSSort(arr, p_index + 1, e_index, qs_m);
+		if (p_index - s_index < e_index - p_index) {
+			QSSort(arr, s_index, p_index, depth_limit, qs_m);
+			s_index = p_index + 1;
+		}
+		else {
+			QSSort(arr, p_index + 1, e_index, depth_limit, qs_m);
+			e_index = p_index;
+		}
+	}
+	QSSortLeaf(arr, s_index, e_index, qs_m);
+}
+
+static std::size_t QSDepthLimit(std::size_t size) {
+	std::size_t depth = 0;
+	while (size > 1) {
+		size >>= 1;
+		depth++;
+	}
+	return 2 * depth;
+}
+
+// Ranges longer than this pick their selection pivot from a sample (Floyd-Rivest).
+static const std::size_t qs_sample_threshold = 600;
+
+// Introselect: partitions like QSSort() but only continues into the side holding nth, so the
+// expected cost is linear. On long ranges the pivot is the element of the right rank in a
+// sample around nth, found recursively, which puts it close to the nth value and leaves about
+// n^(2/3) elements for the next step (Floyd and Rivest, "Expected time bounds for selection").
+// Ranges that still do not shrink in time are heapsorted.
+static void QSSelect(int* arr, std::size_t s_index, std::size_t e_index, std::size_t nth, std::size_t depth_limit, Metrics& qs_m) {
+	while (e_index - s_index + 1 > qs_leaf_size) {
+		if (depth_limit == 0) {
+			QSHeapSort(arr, s_index, e_index, qs_m);
+			return;
+		}
+		depth_limit--;
+		std::size_t size = e_index - s_index + 1;
+		std::size_t m_index = s_index + (e_index - s_index) / 2;
+		if (size > qs_sample_threshold) {
+			double n = static_cast<double>(size), rank = static_cast<double>(nth - s_index);
+			double z = std::log(n);
+			double sample = 0.5 * std::exp(2 * z / 3);
+			double deviation = 0.5 * std::sqrt(z * sample * (n - sample) / n) * (rank < n / 2 ? -1 : 1);
+			double lower = static_cast<double>(nth) - rank * sample / n + deviation;
+			double upper = static_cast<double>(nth) + (n - rank) * sample / n + deviation;
+			std::size_t sample_s = static_cast<std::size_t>(std::max(static_cast<double>(s_index), lower));
+			std::size_t sample_e = static_cast<std::size_t>(std::min(static_cast<double>(e_index), upper));
+			QSSelect(arr, sample_s, sample_e, nth, depth_limit, qs_m);
+			std::swap(arr[nth], arr[m_index]);
+			qs_m.insertion_number += 2;
+		}
+		else {
+			QSChoosePivot(arr, s_index, e_index, qs_m);
+		}
+		std::size_t p_index = QSPartition(arr, s_index, e_index, qs_m);
+		if (nth <= p_index) e_index = p_index;
+		else s_index = p_index + 1;
+	}
+	QSSortLeaf(arr, s_index, e_index, qs_m);
+}
+
+// Pattern-defeating quicksort (Peters): the pivot partition is done in blocks, recording the
+// offsets of misplaced elements first and swapping them afterwards, so the comparisons do not
+// branch. Partitions that needed no swaps are finished by a bounded insertion sort, which makes
+// sorted ranges linear, and bad partitions shuffle a few elements before heapsort takes over.
+static const std::size_t pdq_block_size = 64;
+
+// Insertion sort that gives up after moving pdq_partial_limit elements; returns whether it finished.
+static const std::size_t pdq_partial_limit = 8;
+
+static bool PDQPartialInsertionSort(int* begin, int* end, Metrics& qs_m) {
+	if (begin == end) return true;
+	std::size_t moved = 0;
+	for (int* cur = begin + 1; cur != end; cur++) {
+		qs_m.comparison_number++;
+		if (*cur < *(cur - 1)) {
+			int value = *cur;
+			int* sift = cur;
+			do {
+				*sift = *(sift - 1);
+				sift--;
+				qs_m.comparison_number++;
+			} while (sift != begin && value < *(sift - 1));
+			*sift = value;
+			moved += cur - sift;
+			qs_m.insertion_number += cur - sift + 1;
+		}
+		if (moved > pdq_partial_limit) return false;
+	}
+	return true;
+}
+
+static void PDQSwapOffsets(int* first, int* last, const unsigned char* offsets_l, const unsigned char* offsets_r, std::size_t num, bool use_swaps, Metrics& qs_m) {
+	qs_m.insertion_number += 2 * num;
+	if (use_swaps) {
+		// Both sides have the same count here, so the cyclic version below would be one element short.
+		for (std::size_t i = 0; i < num; i++) {
+			std::swap(first[offsets_l[i]], *(last - offsets_r[i]));
+		}
+	}
+	else if (num > 0) {
+		int* l = first + offsets_l[0];
+		int* r = last - offsets_r[0];
+		int temp = *l;
+		*l = *r;
+		for (std::size_t i = 1; i < num; i++) {
+			l = first + offsets_l[i];
+			*r = *l;
+			r = last - offsets_r[i];
+			*l = *r;
+		}
+		*r = temp;
+	}
+}
+
+// Partitions [begin, end) around *begin into [< pivot][pivot][>= pivot]. Requires an element
+// >= pivot at the end of the range (the median of three puts one there). Returns the pivot
+// position and whether the range was already partitioned.
+static std::pair<int*, bool> PDQPartitionRight(int* begin, int* end, Metrics& qs_m) {
+	int pivot = *begin;
+	int* first = begin;
+	int* last = end;
+	while (*++first < pivot) qs_m.comparison_number++;
+	if (first - 1 == begin) {
+		while (first < last && !(*--last < pivot)) qs_m.comparison_number++;
+	}
+	else {
+		while (!(*--last < pivot)) qs_m.comparison_number++;
+	}
+	qs_m.comparison_number += 2;
+	bool already_partitioned = first >= last;
+	if (!already_partitioned) {
+		std::swap(*first, *last);
+		qs_m.insertion_number += 2;
+		first++;
+		alignas(64) unsigned char offsets_l[pdq_block_size];
+		alignas(64) unsigned char offsets_r[pdq_block_size];
+		int* offsets_l_base = first;
+		int* offsets_r_base = last;
+		std::size_t num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+		while (first < last) {
+			std::size_t num_unknown = last - first;
+			std::size_t left_split = num_l == 0 ? (num_r == 0 ? num_unknown / 2 : num_unknown) : 0;
+			std::size_t right_split = num_r == 0 ? num_unknown - left_split : 0;
+			left_split = std::min(left_split, pdq_block_size);
+			right_split = std::min(right_split, pdq_block_size);
+			for (std::size_t i = 0; i < left_split; i++) {
+				offsets_l[num_l] = static_cast<unsigned char>(i);
+				num_l += !(*first < pivot);
+				first++;
+			}
+			for (std::size_t i = 0; i < right_split;) {
+				offsets_r[num_r] = static_cast<unsigned char>(++i);
+				num_r += *--last < pivot;
+			}
+			qs_m.comparison_number += left_split + right_split;
+			std::size_t num = std::min(num_l, num_r);
+			PDQSwapOffsets(offsets_l_base, offsets_r_base, offsets_l + start_l, offsets_r + start_r, num, num_l == num_r, qs_m);
+			num_l -= num;
+			num_r -= num;
+			start_l += num;
+			start_r += num;
+			if (num_l == 0) {
+				start_l = 0;
+				offsets_l_base = first;
+			}
+			if (num_r == 0) {
+				start_r = 0;
+				offsets_r_base = last;
+			}
+		}
+		// One side may still hold misplaced elements; they go to the far end of the other side.
+		if (num_l) {
+			while (num_l--) {
+				std::swap(offsets_l_base[offsets_l[start_l + num_l]], *--last);
+				qs_m.insertion_number += 2;
+			}
+			first = last;
+		}
+		if (num_r) {
+			while (num_r--) {
+				std::swap(*(offsets_r_base - offsets_r[start_r + num_r]), *first);
+				qs_m.insertion_number += 2;
+				first++;
+			}
+			last = first;
+		}
+	}
+	int* pivot_pos = first - 1;
+	*begin = *pivot_pos;
+	*pivot_pos = pivot;
+	qs_m.insertion_number += 2;
+	return { pivot_pos, already_partitioned };
+}
+
+// Partitions [begin, end) around *begin into [<= pivot][> pivot]; used when the pivot equals the
+// element before the range, so that runs of equal elements are done with in one pass.
+static int* PDQPartitionLeft(int* begin, int* end, Metrics& qs_m) {
+	int pivot = *begin;
+	int* first = begin;
+	int* last = end;
+	while (pivot < *--last) qs_m.comparison_number++;
+	if (last + 1 == end) {
+		while (first < last && !(pivot < *++first)) qs_m.comparison_number++;
+	}
+	else {
+		while (!(pivot < *++first)) qs_m.comparison_number++;
 	}
+	while (first < last) {
+		std::swap(*first, *last);
+		qs_m.insertion_number += 2;
+		while (pivot < *--last) qs_m.comparison_number++;
+		while (!(pivot < *++first)) qs_m.comparison_number++;
+	}
+	*begin = *last;
+	*last = pivot;
+	qs_m.insertion_number += 2;
+	return last;
+}
+
+static void PDQSort(int* begin, int* end, int bad_allowed, bool leftmost, Metrics& qs_m) {
+	while (true) {
+		std::size_t size = end - begin;
+		if (size <= qs_leaf_size) {
+			if (size > 1) QSSortLeaf(begin, 0, size - 1, qs_m);
+			return;
+		}
+		// The median of three (or the ninther) goes to *begin; an element >= pivot stays behind it.
+		QSChoosePivot(begin, 0, size - 1, qs_m);
+		std::swap(begin[0], begin[(size - 1) / 2]);
+		qs_m.insertion_number += 2;
+
+		qs_m.comparison_number++;
+		if (!leftmost && !(*(begin - 1) < *begin)) {
+			begin = PDQPartitionLeft(begin, end, qs_m) + 1;
+			continue;
+		}
+		std::pair<int*, bool> partition = PDQPartitionRight(begin, end, qs_m);
+		int* pivot_pos = partition.first;
+		std::size_t l_size = pivot_pos - begin;
+		std::size_t r_size = end - (pivot_pos + 1);
+		if (l_size < size / 8 || r_size < size / 8) {
+			if (--bad_allowed == 0) {
+				QSHeapSort(begin, 0, size - 1, qs_m);
+				return;
+			}
+			// Breaks up patterns that keep producing bad pivots.
+			if (l_size > qs_insertion_cutoff) {
+				std::swap(begin[0], begin[l_size / 4]);
+				std::swap(pivot_pos[-1], pivot_pos[-static_cast<std::ptrdiff_t>(l_size / 4)]);
+				qs_m.insertion_number += 4;
+			}
+			if (r_size > qs_insertion_cutoff) {
+				std::swap(pivot_pos[1], pivot_pos[1 + r_size / 4]);
+				std::swap(end[-1], end[-static_cast<std::ptrdiff_t>(r_size / 4)]);
+				qs_m.insertion_number += 4;
+			}
+		}
+		else if (partition.second && PDQPartialInsertionSort(begin, pivot_pos, qs_m) && PDQPartialInsertionSort(pivot_pos + 1, end, qs_m)) {
+			return;
+		}
+		PDQSort(begin, pivot_pos, bad_allowed, leftmost, qs_m);
+		begin = pivot_pos + 1;
+		leftmost = false;
+	}
+}
+
+// Inputs that are one ascending or descending run are done in a single pass.
+static void PDQSortRange(int* arr, std::size_t size, Metrics& qs_m) {
+	if (size < 2) return;
+	std::size_t run = 1;
+	bool descending = arr[1] < arr[0];
+	while (run < size && (descending ? !(arr[run - 1] < arr[run]) : !(arr[run] < arr[run - 1]))) run++;
+	qs_m.comparison_number += run;
+	if (run == size) {
+		if (descending) {
+			std::reverse(arr, arr + size);
+			qs_m.insertion_number += size;
+		}
+		return;
+	}
+	PDQSort(arr, arr + size, static_cast<int>(QSDepthLimit(size) / 2), true, qs_m);
+}
+
+static void AddCounts(Metrics& to, const Metrics& from) {
+	to.comparison_number += from.comparison_number;
+	to.insertion_number += from.insertion_number;
+}
+
+// Below these sizes the parallel sorts stop forking and run sequentially.
+static const std::size_t parallel_sort_grain = 1 << 14;
+static const std::size_t parallel_merge_grain = 1 << 15;
+
+static void PMSSequentialMerge(const int* a, std::size_t a_size, const int* b, std::size_t b_size, int* out, Metrics& ms_m) {
+	MergeRuns(a, a_size, b, b_size, out);
+	ms_m.insertion_number += a_size + b_size;
+}
+
+// Co-ranking: the number of elements of a among the first k of the stable merge of a and b.
+static std::size_t PMSCoRank(std::size_t k, const int* a, std::size_t a_size, const int* b, std::size_t b_size) {
+	std::size_t low = k > b_size ? k - b_size : 0;
+	std::size_t high = std::min(k, a_size);
+	while (low < high) {
+		std::size_t i = low + (high - low) / 2;
+		if (!(b[k - i - 1] < a[i])) low = i + 1;
+		else high = i;
+	}
+	return low;
+}
+
+// Splits the output in halves, finds where each half starts in a and b, and merges both in parallel.
+static void PMSMerge(ThreadPool& pool, const int* a, std::size_t a_size, const int* b, std::size_t b_size, int* out, Metrics& ms_m) {
+	std::size_t size = a_size + b_size;
+	if (size <= parallel_merge_grain) {
+		PMSSequentialMerge(a, a_size, b, b_size, out, ms_m);
+		return;
+	}
+	std::size_t k = size / 2;
+	std::size_t i = PMSCoRank(k, a, a_size, b, b_size);
+	Metrics right_m;
+	pool.Invoke(
+		[&]() { PMSMerge(pool, a, i, b, k - i, out, ms_m); },
+		[&]() { PMSMerge(pool, a + i, a_size - i, b + (k - i), b_size - (k - i), out + k, right_m); });
+	AddCounts(ms_m, right_m);
+}
+
+// Sorts arr into arr itself or into temp_arr; the halves are sorted into the other buffer,
+// so every level merges from one buffer into the other without copying back.
+static void PMSSort(ThreadPool& pool, int* arr, int* temp_arr, std::size_t size, bool to_temp, Metrics& ms_m) {
+	if (size <= parallel_sort_grain) {
+		PDQSortRange(arr, size, ms_m);
+		if (to_temp) std::copy(arr, arr + size, temp_arr);
+		return;
+	}
+	std::size_t half = size / 2;
+	Metrics right_m;
+	pool.Invoke(
+		[&]() { PMSSort(pool, arr, temp_arr, half, !to_temp, ms_m); },
+		[&]() { PMSSort(pool, arr + half, temp_arr + half, size - half, !to_temp, right_m); });
+	AddCounts(ms_m, right_m);
+	const int* source = to_temp ? arr : temp_arr;
+	PMSMerge(pool, source, half, source + half, size - half, to_temp ? temp_arr : arr, ms_m);
+}
+
+static void PQSSort(ThreadPool& pool, int* arr, std::size_t s_index, std::size_t e_index, std::size_t depth_limit, Metrics& qs_m) {
+	if (e_index - s_index + 1 <= parallel_sort_grain || depth_limit == 0) {
+		QSSort(arr, s_index, e_index, depth_limit, qs_m);
+		return;
+	}
+	std::size_t p_index = QSDevide(arr, s_index, e_index, qs_m);
+	Metrics right_m;
+	pool.Invoke(
+		[&]() { PQSSort(pool, arr, s_index, p_index, depth_limit - 1, qs_m); },
+		[&]() { PQSSort(pool, arr, p_index + 1, e_index, depth_limit - 1, right_m); });
+	AddCounts(qs_m, right_m);
+}
+
+// Radix sorts work on bytes of the key with the sign bit flipped, so that negative values
+// come first when the bytes are compared as unsigned.
+static const int radix_bits = 8;
+static const std::size_t radix_buckets = 1 << radix_bits;
+// From this size on ParallelRadixSort splits the array by its top byte first.
+static const std::size_t parallel_radix_threshold = 1 << 20;
+// Below this size FastSort prefers PdqSort: the radix histograms and scratch buffer do not pay off.
+static const std::size_t fast_sort_radix_threshold = 1 << 11;
+
+static std::size_t RSDigit(int value, int pass) {
+	return ((static_cast<uint32_t>(value) ^ 0x80000000u) >> (pass * radix_bits)) & (radix_buckets - 1);
+}
+
+// LSD radix sort by the lowest `passes` bytes, moving the elements back and forth between arr
+// and temp_arr; returns the one holding the result. The histograms of all passes are gathered
+// in a single read, and a pass is skipped when all keys share its digit.
+static int* RSSortLSD(int* arr, int* temp_arr, std::size_t size, int passes, Metrics& rs_m) {
+	std::size_t counts[32 / radix_bits][radix_buckets] = {};
+	for (std::size_t index = 0; index < size; index++) {
+		for (int pass = 0; pass < passes; pass++) {
+			counts[pass][RSDigit(arr[index], pass)]++;
+		}
+	}
+	int* from = arr;
+	int* to = temp_arr;
+	for (int pass = 0; pass < passes && size > 0; pass++) {
+		std::size_t* offsets = counts[pass];
+		if (offsets[RSDigit(from[0], pass)] == size) continue;
+		std::size_t sum = 0;
+		for (std::size_t digit = 0; digit < radix_buckets; digit++) {
+			std::size_t count = offsets[digit];
+			offsets[digit] = sum;
+			sum += count;
+		}
+		for (std::size_t index = 0; index < size; index++) {
+			to[offsets[RSDigit(from[index], pass)]++] = from[index];
+		}
+		rs_m.insertion_number += size;
+		std::swap(from, to);
+	}
+	return from;
+}
+
+// MSD step for large arrays: the top byte is counted and scattered into temp_arr in parallel
+// chunks, then every bucket is finished by an LSD sort of its lower bytes as a separate task.
+static void RSSortParallel(ThreadPool& pool, int* arr, int* temp_arr, std::size_t size, Metrics& rs_m) {
+	const int top_pass = 32 / radix_bits - 1;
+	std::size_t chunks = std::min<std::size_t>(pool.GetThreadCount() * 4, size / parallel_sort_grain + 1);
+	std::size_t chunk_size = (size + chunks - 1) / chunks;
+	std::vector<std::array<std::size_t, radix_buckets>> offsets(chunks);
+	pool.ForEach(chunks, [&](std::size_t chunk) {
+		offsets[chunk].fill(0);
+		for (std::size_t index = chunk * chunk_size; index < std::min(size, (chunk + 1) * chunk_size); index++) {
+			offsets[chunk][RSDigit(arr[index], top_pass)]++;
+		}
+	});
+	std::vector<std::size_t> bucket_begin(radix_buckets + 1, 0);
+	std::size_t sum = 0;
+	for (std::size_t digit = 0; digit < radix_buckets; digit++) {
+		bucket_begin[digit] = sum;
+		for (std::size_t chunk = 0; chunk < chunks; chunk++) {
+			std::size_t count = offsets[chunk][digit];
+			offsets[chunk][digit] = sum;
+			sum += count;
+		}
+	}
+	bucket_begin[radix_buckets] = sum;
+	pool.ForEach(chunks, [&](std::size_t chunk) {
+		for (std::size_t index = chunk * chunk_size; index < std::min(size, (chunk + 1) * chunk_size); index++) {
+			temp_arr[offsets[chunk][RSDigit(arr[index], top_pass)]++] = arr[index];
+		}
+	});
+	rs_m.insertion_number += size;
+	std::vector<Metrics> bucket_m(radix_buckets);
+	pool.ForEach(radix_buckets, [&](std::size_t digit) {
+		std::size_t begin = bucket_begin[digit];
+		std::size_t bucket_size = bucket_begin[digit + 1] - begin;
+		int* result = RSSortLSD(temp_arr + begin, arr + begin, bucket_size, top_pass, bucket_m[digit]);
+		if (result != arr + begin) {
+			std::copy(result, result + bucket_size, arr + begin);
+			bucket_m[digit].insertion_number += bucket_size;
+		}
+	});
+	for (const Metrics& m : bucket_m) AddCounts(rs_m, m);
 }
 
 void BubbleSort(int* arr, std::size_t size) {
-	using namespace std::chrono;
 	Metrics bs_m;
 	std::size_t to_compare = size;
-	auto start = high_resolution_clock::now();
-	while (to_compare != 1) {
+	auto start = StartMeasure();
+	while (to_compare > 1) {
 		for (std::size_t index = 1; index < to_compare; index++) {
 			if (arr[index - 1] > arr[index]) {
 				std::swap(arr[index - 1], arr[index]);
@@ -96,16 +805,14 @@ void BubbleSort(int* arr, std::size_t size) {
 		}
 		to_compare--;
 	}
-	auto stop = high_resolution_clock::now();
-	bs_m.sec_time = duration_cast<milliseconds>(stop - start);
+	StopMeasure(bs_m, start);
 	PrintMetrics(bs_m, arr, size);
 }
 
 void InsertionSort(int* arr, std::size_t size) {
-	using namespace std::chrono;
 	Metrics is_m;
 	std::size_t index1 = 1;
-	auto start = high_resolution_clock::now();
+	auto start = StartMeasure();
 	while (index1 < size) {
 		std::size_t index2 = index1;
 		while (index2 > 0 && arr[index2 - 1] > arr[index2]) {
@@ -117,31 +824,147 @@ void InsertionSort(int* arr, std::size_t size) {
 		is_m.comparison_number++;
 		index1 += 1;
 	}
-	auto stop = high_resolution_clock::now();
-	is_m.sec_time = duration_cast<milliseconds>(stop - start);
+	StopMeasure(is_m, start);
 	PrintMetrics(is_m, arr, size);
 }
 
 void MergeSort(int* arr, std::size_t size) {
-	using namespace std::chrono;
+	std::unique_ptr<int[]> scratch_arr(new int[size]);
+	MergeSort(arr, size, scratch_arr.get());
+}
+
+void MergeSort(int* arr, std::size_t size, int* scratch_arr) {
 	Metrics ms_m;
-	std::size_t s_index = 0, e_index = size - 1;
-	int* temp_arr = new int[size];
-	auto start = high_resolution_clock::now();
-	MSSplit(arr, temp_arr, s_index, e_index, ms_m);
-	auto stop = high_resolution_clock::now();
-	ms_m.sec_time = duration_cast<milliseconds>(stop - start);
-	PrintMetrics(ms_m, temp_arr, size);
+	auto start = StartMeasure();
+	MSSort(arr, scratch_arr, size, ms_m);
+	StopMeasure(ms_m, start);
+	PrintMetrics(ms_m, arr, size);
 }
 
 void QuickSort(int* arr, std::size_t size) {
-	using namespace std::chrono;
 	Metrics qs_m;
 	std::size_t s_index = 0, e_index = size - 1;
-	auto start = high_resolution_clock::now();
-	QSSort(arr, s_index, e_index, qs_m);
-	auto stop = high_resolution_clock::now();
-	qs_m.sec_time = duration_cast<milliseconds>(stop - start);
+	auto start = StartMeasure();
+	if (size > 1) QSSort(arr, s_index, e_index, QSDepthLimit(size), qs_m);
+	StopMeasure(qs_m, start);
 	PrintMetrics(qs_m, arr, size);
 }
 
+
+void PdqSort(int* arr, std::size_t size) {
+	Metrics qs_m;
+	auto start = StartMeasure();
+	PDQSortRange(arr, size, qs_m);
+	StopMeasure(qs_m, start);
+	PrintMetrics(qs_m, arr, size);
+}
+
+void ParallelMergeSort(int* arr, std::size_t size) {
+	Metrics ms_m;
+	std::unique_ptr<int[]> temp_arr(new int[size]);
+	auto start = StartMeasure();
+	PMSSort(ThreadPool::GetDefault(), arr, temp_arr.get(), size, false, ms_m);
+	StopMeasure(ms_m, start);
+	PrintMetrics(ms_m, arr, size);
+}
+
+void ParallelQuickSort(int* arr, std::size_t size) {
+	Metrics qs_m;
+	auto start = StartMeasure();
+	if (size > 1) PQSSort(ThreadPool::GetDefault(), arr, 0, size - 1, QSDepthLimit(size), qs_m);
+	StopMeasure(qs_m, start);
+	PrintMetrics(qs_m, arr, size);
+}
+
+void RadixSort(int* arr, std::size_t size) {
+	Metrics rs_m;
+	std::unique_ptr<int[]> temp_arr(new int[size]);
+	auto start = StartMeasure();
+	int* result = RSSortLSD(arr, temp_arr.get(), size, 32 / radix_bits, rs_m);
+	if (result != arr) {
+		std::copy(result, result + size, arr);
+		rs_m.insertion_number += size;
+	}
+	StopMeasure(rs_m, start);
+	PrintMetrics(rs_m, arr, size);
+}
+
+void ParallelRadixSort(int* arr, std::size_t size) {
+	Metrics rs_m;
+	std::unique_ptr<int[]> temp_arr(new int[size]);
+	auto start = StartMeasure();
+	if (size < parallel_radix_threshold) {
+		int* result = RSSortLSD(arr, temp_arr.get(), size, 32 / radix_bits, rs_m);
+		if (result != arr) {
+			std::copy(result, result + size, arr);
+			rs_m.insertion_number += size;
+		}
+	}
+	else {
+		RSSortParallel(ThreadPool::GetDefault(), arr, temp_arr.get(), size, rs_m);
+	}
+	StopMeasure(rs_m, start);
+	PrintMetrics(rs_m, arr, size);
+}
+
+void FastSort(int* arr, std::size_t size) {
+	Metrics unused;
+	if (size < fast_sort_radix_threshold) {
+		PDQSortRange(arr, size, unused);
+		return;
+	}
+	std::unique_ptr<int[]> temp_arr(new int[size]);
+	if (size >= parallel_radix_threshold) {
+		RSSortParallel(ThreadPool::GetDefault(), arr, temp_arr.get(), size, unused);
+		return;
+	}
+	int* result = RSSortLSD(arr, temp_arr.get(), size, 32 / radix_bits, unused);
+	if (result != arr) std::copy(result, result + size, arr);
+}
+
+void NthElement(int* arr, std::size_t size, std::size_t nth) {
+	Metrics unused;
+	if (nth >= size) return;
+	QSSelect(arr, 0, size - 1, nth, QSDepthLimit(size), unused);
+}
+
+void PartialSort(int* arr, std::size_t size, std::size_t count) {
+	Metrics unused;
+	if (count == 0 || size == 0) return;
+	if (count < size) QSSelect(arr, 0, size - 1, count - 1, QSDepthLimit(size), unused);
+	PDQSortRange(arr, std::min(count, size), unused);
+}
+
+TopK::TopK(std::size_t count) : count(count) {
+	values.reserve(2 * count);
+}
+
+void TopK::Push(const int* data, std::size_t size) {
+	if (count == 0) return;
+	std::size_t index = 0;
+	while (index < size) {
+		if (has_threshold) {
+			index += FindGreater(data + index, size - index, threshold);
+			if (index == size) return;
+		}
+		values.push_back(data[index++]);
+		if (values.size() == 2 * count) Shrink();
+	}
+}
+
+std::vector<int> TopK::GetValues() const {
+	TopK copy(*this);
+	if (copy.values.size() > count) copy.Shrink();
+	PartialSort(copy.values.data(), copy.values.size(), copy.values.size());
+	std::reverse(copy.values.begin(), copy.values.end());
+	return copy.values;
+}
+
+// Keeps the count largest values, which start with the smallest of them after the selection.
+void TopK::Shrink() {
+	std::size_t excess = values.size() - count;
+	NthElement(values.data(), values.size(), excess);
+	values.erase(values.begin(), values.begin() + excess);
+	threshold = values[0];
+	has_threshold = true;
+}
@@ -1,6 +1,28 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "PerfCounters.h"
+
+// What one call of the sortings below measured.
+struct SortReport {
+	std::chrono::nanoseconds time{};
+	std::size_t comparisons = 0;
+	std::size_t moves = 0;
+	bool sorted = false;
+	HardwareCounts hardware;
+};
+
+// While a report is set, the sortings below store their metrics in it instead of printing
+// them. Pass nullptr to print again.
+void SetSortReport(SortReport* report);
 
 void BubbleSort(int* arr, std::size_t size);
 
@@ -8,4 +30,369 @@ void InsertionSort(int* arr, std::size_t size);
 
 void MergeSort(int* arr, std::size_t size);
 
+// Uses scratch_arr, which must hold at least size elements, instead of allocating.
+void MergeSort(int* arr, std::size_t size, int* scratch_arr);
+
 void QuickSort(int* arr, std::size_t size);
+
+void PdqSort(int* arr, std::size_t size);
+
+// Run on ThreadPool::GetDefault().
+void ParallelMergeSort(int* arr, std::size_t size);
+
+void ParallelQuickSort(int* arr, std::size_t size);
+
+void RadixSort(int* arr, std::size_t size);
+
+void ParallelRadixSort(int* arr, std::size_t size);
+
+// Sorts ascending without timing or printing anything: radix sort for larger arrays, in
+// parallel for the largest, and PdqSort with the vector kernels below that.
+void FastSort(int* arr, std::size_t size);
+
+// Selection, quiet like FastSort(). NthElement() puts the element that sorting would put at
+// nth there, with nothing greater before it and nothing smaller after it, in expected O(n).
+void NthElement(int* arr, std::size_t size, std::size_t nth);
+
+// Sorts the count smallest elements into the front of arr in O(n + count log count); the
+// order of the rest is unspecified.
+void PartialSort(int* arr, std::size_t size, std::size_t count);
+
+// Keeps the count largest values of a stream. Values are collected up to twice count, then
+// NthElement() drops the smaller half, so every value costs O(1) amortized even on ascending
+// input. Values not above the smallest one kept are skipped a vector at a time with FindGreater().
+class TopK {
+public:
+	explicit TopK(std::size_t count);
+
+	void Push(const int* data, std::size_t size);
+
+	// The values kept so far, largest first.
+	std::vector<int> GetValues() const;
+
+private:
+	std::size_t count;
+	std::vector<int> values;
+	int threshold = 0;
+	bool has_threshold = false;
+
+	void Shrink();
+};
+
+
+// Generic sorts over random-access iterators. Elements are compared as comp(proj(a), proj(b)),
+// where proj may also be a pointer to member, e.g. Sort(v.begin(), v.end(), std::less<>(), &Record::key).
+// Contiguous int ranges with std::less or std::greater and no projection go to FastSort().
+struct Identity {
+	template <class T>
+	constexpr T&& operator()(T&& value) const noexcept {
+		return std::forward<T>(value);
+	}
+};
+
+namespace SortingDetails {
+	const std::ptrdiff_t insertion_cutoff = 24;
+	const std::ptrdiff_t ninther_threshold = 128;
+	const std::ptrdiff_t block_size = 64;
+	const std::ptrdiff_t partial_limit = 8;
+	const std::ptrdiff_t merge_run = 32;
+
+	template <class It, class Compare, class Projection>
+	constexpr bool IsFastInt() {
+		using Value = std::remove_cv_t<typename std::iterator_traits<It>::value_type>;
+		return std::is_same_v<Value, int> && std::is_same_v<Projection, Identity> &&
+			(std::is_pointer_v<It> || std::is_same_v<It, std::vector<int>::iterator>) &&
+			(std::is_same_v<Compare, std::less<>> || std::is_same_v<Compare, std::less<int>> ||
+				std::is_same_v<Compare, std::greater<>> || std::is_same_v<Compare, std::greater<int>>);
+	}
+
+	template <class Compare>
+	constexpr bool IsGreater() {
+		return std::is_same_v<Compare, std::greater<>> || std::is_same_v<Compare, std::greater<int>>;
+	}
+
+	// Comparisons on arithmetic keys with the standard comparators compile to a flag, not a
+	// branch, which is what the block partition relies on.
+	template <class It, class Compare, class Projection>
+	constexpr bool IsBranchless() {
+		using Key = std::decay_t<std::invoke_result_t<Projection&, typename std::iterator_traits<It>::reference>>;
+		return std::is_arithmetic_v<Key> &&
+			(std::is_same_v<Compare, std::less<>> || std::is_same_v<Compare, std::less<Key>> ||
+				std::is_same_v<Compare, std::greater<>> || std::is_same_v<Compare, std::greater<Key>>);
+	}
+
+	template <class It, class Less>
+	void InsertionSort(It first, It last, Less& less) {
+		if (first == last) return;
+		for (It current = first + 1; current != last; ++current) {
+			if (less(*current, *(current - 1))) {
+				auto value = std::move(*current);
+				It sift = current;
+				do {
+					*sift = std::move(*(sift - 1));
+					--sift;
+				} while (sift != first && less(value, *(sift - 1)));
+				*sift = std::move(value);
+			}
+		}
+	}
+
+	// Gives up after moving partial_limit elements; returns whether the range got sorted.
+	template <class It, class Less>
+	bool PartialInsertionSort(It first, It last, Less& less) {
+		if (first == last) return true;
+		std::ptrdiff_t moved = 0;
+		for (It current = first + 1; current != last; ++current) {
+			if (less(*current, *(current - 1))) {
+				auto value = std::move(*current);
+				It sift = current;
+				do {
+					*sift = std::move(*(sift - 1));
+					--sift;
+				} while (sift != first && less(value, *(sift - 1)));
+				*sift = std::move(value);
+				moved += current - sift;
+			}
+			if (moved > partial_limit) return false;
+		}
+		return true;
+	}
+
+	template <class It, class Less>
+	void Sort3(It a, It b, It c, Less& less) {
+		if (less(*b, *a)) std::iter_swap(a, b);
+		if (less(*c, *b)) std::iter_swap(b, c);
+		if (less(*b, *a)) std::iter_swap(a, b);
+	}
+
+	// Puts the median of three (or the ninther) into *first and leaves an element that is not
+	// less than it at the end of the range.
+	template <class It, class Less>
+	void ChoosePivot(It first, It last, Less& less) {
+		std::ptrdiff_t size = last - first;
+		It middle = first + (size - 1) / 2;
+		if (size >= ninther_threshold) {
+			std::ptrdiff_t step = size / 8;
+			Sort3(first, first + step, first + 2 * step, less);
+			Sort3(middle - step, middle, middle + step, less);
+			Sort3(last - 1 - 2 * step, last - 1 - step, last - 1, less);
+			Sort3(first + step, middle, last - 1 - step, less);
+		}
+		else {
+			Sort3(first, middle, last - 1, less);
+		}
+		std::iter_swap(first, middle);
+	}
+
+	// Partitions [first, last) around *first into [< pivot][pivot][>= pivot]; returns the pivot
+	// position and whether nothing had to be moved. With Branchless the elements are classified
+	// a block at a time into offset buffers and swapped afterwards.
+	template <bool Branchless, class It, class Less>
+	std::pair<It, bool> PartitionRight(It first, It last, Less& less) {
+		auto pivot = std::move(*first);
+		It begin = first;
+		It left = first;
+		It right = last;
+		while (less(*++left, pivot));
+		if (left - 1 == begin) {
+			while (left < right && !less(*--right, pivot));
+		}
+		else {
+			while (!less(*--right, pivot));
+		}
+		bool already_partitioned = left >= right;
+		if (!already_partitioned) {
+			std::iter_swap(left, right);
+			++left;
+			if (Branchless) {
+				unsigned char offsets_l[block_size];
+				unsigned char offsets_r[block_size];
+				It offsets_l_base = left;
+				It offsets_r_base = right;
+				std::ptrdiff_t num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+				while (left < right) {
+					std::ptrdiff_t num_unknown = right - left;
+					std::ptrdiff_t left_split = num_l == 0 ? (num_r == 0 ? num_unknown / 2 : num_unknown) : 0;
+					std::ptrdiff_t right_split = num_r == 0 ? num_unknown - left_split : 0;
+					left_split = std::min(left_split, block_size);
+					right_split = std::min(right_split, block_size);
+					for (std::ptrdiff_t i = 0; i < left_split; i++) {
+						offsets_l[num_l] = static_cast<unsigned char>(i);
+						num_l += !less(*left, pivot);
+						++left;
+					}
+					for (std::ptrdiff_t i = 0; i < right_split;) {
+						offsets_r[num_r] = static_cast<unsigned char>(++i);
+						num_r += less(*--right, pivot);
+					}
+					std::ptrdiff_t num = std::min(num_l, num_r);
+					for (std::ptrdiff_t i = 0; i < num; i++) {
+						std::iter_swap(offsets_l_base + offsets_l[start_l + i], offsets_r_base - offsets_r[start_r + i]);
+					}
+					num_l -= num;
+					num_r -= num;
+					start_l += num;
+					start_r += num;
+					if (num_l == 0) {
+						start_l = 0;
+						offsets_l_base = left;
+					}
+					if (num_r == 0) {
+						start_r = 0;
+						offsets_r_base = right;
+					}
+				}
+				while (num_l > 0) {
+					--num_l;
+					std::iter_swap(offsets_l_base + offsets_l[start_l + num_l], --right);
+					left = right;
+				}
+				while (num_r > 0) {
+					--num_r;
+					std::iter_swap(offsets_r_base - offsets_r[start_r + num_r], left);
+					++left;
+					right = left;
+				}
+			}
+			else {
+				while (true) {
+					while (less(*left, pivot)) ++left;
+					while (!less(*--right, pivot));
+					if (left >= right) break;
+					std::iter_swap(left, right);
+					++left;
+				}
+			}
+		}
+		It pivot_pos = left - 1;
+		*begin = std::move(*pivot_pos);
+		*pivot_pos = std::move(pivot);
+		return { pivot_pos, already_partitioned };
+	}
+
+	// Partitions [first, last) into [<= pivot][> pivot]; used when the pivot equals the element
+	// before the range, which takes a whole run of equal elements out in one pass.
+	template <class It, class Less>
+	It PartitionLeft(It first, It last, Less& less) {
+		auto pivot = std::move(*first);
+		It left = first;
+		It right = last;
+		while (less(pivot, *--right));
+		if (right + 1 == last) {
+			while (left < right && !less(pivot, *++left));
+		}
+		else {
+			while (!less(pivot, *++left));
+		}
+		while (left < right) {
+			std::iter_swap(left, right);
+			while (less(pivot, *--right));
+			while (!less(pivot, *++left));
+		}
+		*first = std::move(*right);
+		*right = std::move(pivot);
+		return right;
+	}
+
+	template <bool Branchless, class It, class Less>
+	void PdqLoop(It first, It last, Less& less, int bad_allowed, bool leftmost) {
+		while (true) {
+			std::ptrdiff_t size = last - first;
+			if (size < insertion_cutoff) {
+				InsertionSort(first, last, less);
+				return;
+			}
+			ChoosePivot(first, last, less);
+			if (!leftmost && !less(*(first - 1), *first)) {
+				first = PartitionLeft(first, last, less) + 1;
+				continue;
+			}
+			std::pair<It, bool> partition = PartitionRight<Branchless>(first, last, less);
+			It pivot_pos = partition.first;
+			std::ptrdiff_t l_size = pivot_pos - first;
+			std::ptrdiff_t r_size = last - (pivot_pos + 1);
+			if (l_size < size / 8 || r_size < size / 8) {
+				if (--bad_allowed == 0) {
+					std::make_heap(first, last, less);
+					std::sort_heap(first, last, less);
+					return;
+				}
+				if (l_size >= insertion_cutoff) {
+					std::iter_swap(first, first + l_size / 4);
+					std::iter_swap(pivot_pos - 1, pivot_pos - l_size / 4);
+				}
+				if (r_size >= insertion_cutoff) {
+					std::iter_swap(pivot_pos + 1, pivot_pos + 1 + r_size / 4);
+					std::iter_swap(last - 1, last - r_size / 4);
+				}
+			}
+			else if (partition.second && PartialInsertionSort(first, pivot_pos, less) && PartialInsertionSort(pivot_pos + 1, last, less)) {
+				return;
+			}
+			PdqLoop<Branchless>(first, pivot_pos, less, bad_allowed, leftmost);
+			first = pivot_pos + 1;
+			leftmost = false;
+		}
+	}
+
+	template <class InIt, class OutIt, class Less>
+	OutIt MergeMove(InIt a, InIt a_end, InIt b, InIt b_end, OutIt out, Less& less) {
+		while (a != a_end && b != b_end) {
+			if (less(*b, *a)) *out++ = std::move(*b++);
+			else *out++ = std::move(*a++);
+		}
+		out = std::move(a, a_end, out);
+		return std::move(b, b_end, out);
+	}
+}
+
+// Unstable sort: pattern-defeating quicksort, with block partitioning for arithmetic keys.
+template <class RandomIt, class Compare = std::less<>, class Projection = Identity>
+void Sort(RandomIt first, RandomIt last, Compare comp = Compare(), Projection proj = Projection()) {
+	if constexpr (SortingDetails::IsFastInt<RandomIt, Compare, Projection>()) {
+		if (first == last) return;
+		FastSort(&*first, last - first);
+		if (SortingDetails::IsGreater<Compare>()) std::reverse(first, last);
+	}
+	else {
+		auto less = [&](const auto& a, const auto& b) { return std::invoke(comp, std::invoke(proj, a), std::invoke(proj, b)); };
+		std::ptrdiff_t size = last - first;
+		int depth = 0;
+		while (size >>= 1) depth++;
+		SortingDetails::PdqLoop<SortingDetails::IsBranchless<RandomIt, Compare, Projection>()>(first, last, less, depth, true);
+	}
+}
+
+// Stable sort: bottom-up merge sort over insertion-sorted runs, moving the elements back and
+// forth between the range and one buffer.
+template <class RandomIt, class Compare = std::less<>, class Projection = Identity>
+void StableSort(RandomIt first, RandomIt last, Compare comp = Compare(), Projection proj = Projection()) {
+	if constexpr (SortingDetails::IsFastInt<RandomIt, Compare, Projection>()) {
+		// Equal ints cannot be told apart, so stability does not matter here.
+		Sort(first, last, comp, proj);
+	}
+	else {
+		auto less = [&](const auto& a, const auto& b) { return std::invoke(comp, std::invoke(proj, a), std::invoke(proj, b)); };
+		std::ptrdiff_t size = last - first;
+		for (RandomIt run = first; run < last; run += std::min(SortingDetails::merge_run, last - run)) {
+			SortingDetails::InsertionSort(run, run + std::min(SortingDetails::merge_run, last - run), less);
+		}
+		if (size <= SortingDetails::merge_run) return;
+		std::vector<typename std::iterator_traits<RandomIt>::value_type> buffer(std::make_move_iterator(first), std::make_move_iterator(last));
+		bool in_buffer = true;
+		for (std::ptrdiff_t width = SortingDetails::merge_run; width < size; width *= 2) {
+			for (std::ptrdiff_t start = 0; start < size; start += 2 * width) {
+				std::ptrdiff_t middle = std::min(start + width, size);
+				std::ptrdiff_t end = std::min(start + 2 * width, size);
+				if (in_buffer) {
+					SortingDetails::MergeMove(buffer.begin() + start, buffer.begin() + middle, buffer.begin() + middle, buffer.begin() + end, first + start, less);
+				}
+				else {
+					SortingDetails::MergeMove(first + start, first + middle, first + middle, first + end, buffer.begin() + start, less);
+				}
+			}
+			in_buffer = !in_buffer;
+		}
+		if (in_buffer) std::move(buffer.begin(), buffer.end(), first);
+	}
+}
@@ -0,0 +1,158 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+static thread_local const ThreadPool* current_pool = nullptr;
+static thread_local std::size_t current_index = 0;
+
+ThreadPool::ThreadPool(std::size_t thread_count) {
+	for (std::size_t index = 0; index <= thread_count; index++) {
+		queues.push_back(std::make_unique<Queue>());
+	}
+	for (std::size_t index = 0; index < thread_count; index++) {
+		workers.emplace_back([this, index]() { WorkerLoop(index); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::GetDefault() {
+	static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+void ThreadPool::Invoke(const std::function<void()>& left, const std::function<void()>& right) {
+	if (workers.empty()) {
+		left();
+		right();
+		return;
+	}
+	Task task;
+	task.body = &right;
+	std::size_t index = GetQueueIndex();
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		pending++;
+	}
+	{
+		std::lock_guard<std::mutex> lock(queues[index]->mutex);
+		queues[index]->tasks.push_back(&task);
+	}
+	wake.notify_one();
+	// If left() throws, the task must not stay queued once this frame is gone: it is taken back,
+	// or, when a worker already runs it, waited for.
+	struct UnwindGuard {
+		ThreadPool& pool;
+		std::size_t index;
+		Task& task;
+		bool active = true;
+		~UnwindGuard() {
+			if (active && !pool.Reclaim(index, &task)) {
+				while (!task.done.load(std::memory_order_acquire)) std::this_thread::yield();
+			}
+		}
+	} guard{ *this, index, task };
+	left();
+	guard.active = false;
+	// Everything left forked is finished by now, so unless it was stolen the task is on top.
+	if (Reclaim(index, &task)) {
+		right();
+		return;
+	}
+	while (!task.done.load(std::memory_order_acquire)) {
+		Task* other = Take(index);
+		if (other != nullptr) {
+			Run(other);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void ThreadPool::ForEach(std::size_t count, const std::function<void(std::size_t)>& body) {
+	if (count > 0) {
+		ForEachRange(0, count, body);
+	}
+}
+
+void ThreadPool::ForEachRange(std::size_t begin, std::size_t end, const std::function<void(std::size_t)>& body) {
+	if (end - begin == 1) {
+		body(begin);
+		return;
+	}
+	std::size_t middle = begin + (end - begin) / 2;
+	Invoke([&]() { ForEachRange(begin, middle, body); }, [&]() { ForEachRange(middle, end, body); });
+}
+
+void ThreadPool::WorkerLoop(std::size_t index) {
+	current_pool = this;
+	current_index = index;
+	while (true) {
+		Task* task = Take(index);
+		if (task != nullptr) {
+			Run(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake.wait(lock, [this]() { return stopping || pending > 0; });
+		if (stopping) {
+			return;
+		}
+	}
+}
+
+bool ThreadPool::Reclaim(std::size_t index, Task* task) {
+	std::lock_guard<std::mutex> lock(queues[index]->mutex);
+	std::deque<Task*>& tasks = queues[index]->tasks;
+	// Normally the task is on top; after an exception, or in the queue shared by outside threads,
+	// it may be further down.
+	auto found = std::find(tasks.rbegin(), tasks.rend(), task);
+	if (found == tasks.rend()) {
+		return false;
+	}
+	tasks.erase(std::next(found).base());
+	pending--;
+	return true;
+}
+
+std::size_t ThreadPool::GetQueueIndex() const {
+	return current_pool == this ? current_index : workers.size();
+}
+
+ThreadPool::Task* ThreadPool::Take(std::size_t index) {
+	{
+		std::lock_guard<std::mutex> lock(queues[index]->mutex);
+		std::deque<Task*>& tasks = queues[index]->tasks;
+		if (!tasks.empty()) {
+			Task* task = tasks.back();
+			tasks.pop_back();
+			pending--;
+			return task;
+		}
+	}
+	for (std::size_t offset = 1; offset < queues.size(); offset++) {
+		Queue& victim = *queues[(index + offset) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			Task* task = victim.tasks.front();
+			victim.tasks.pop_front();
+			pending--;
+			return task;
+		}
+	}
+	return nullptr;
+}
+
+void ThreadPool::Run(Task* task) {
+	(*task->body)();
+	task->done.store(true, std::memory_order_release);
+}
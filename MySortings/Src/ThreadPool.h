@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool for the parallel sorts. Every worker owns a deque: it pushes and pops its own
+// tasks at the back, idle workers steal from the front of the others, so the oldest (largest)
+// pieces of a recursion are the ones that move between threads.
+class ThreadPool {
+public:
+	explicit ThreadPool(std::size_t thread_count);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// One worker per hardware thread besides the caller, which works too while it waits.
+	static ThreadPool& GetDefault();
+
+	std::size_t GetThreadCount() const {
+		return workers.size() + 1;
+	}
+
+	// Runs left and right, possibly in parallel, and returns once both are done. The calling
+	// thread runs left itself and, if right was stolen, helps with other tasks until it is done.
+	void Invoke(const std::function<void()>& left, const std::function<void()>& right);
+
+	// Calls body(index) for every index in [0, count), splitting the range with Invoke().
+	void ForEach(std::size_t count, const std::function<void(std::size_t)>& body);
+
+private:
+	struct Task {
+		const std::function<void()>* body;
+		std::atomic<bool> done{ false };
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task*> tasks;
+	};
+
+	std::vector<std::thread> workers;
+	// One queue per worker and a last one shared by the threads outside the pool.
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	std::atomic<std::size_t> pending{ 0 };
+	bool stopping = false;
+
+	void ForEachRange(std::size_t begin, std::size_t end, const std::function<void(std::size_t)>& body);
+	void WorkerLoop(std::size_t index);
+	// Removes task from queue index unless it was stolen; returns whether it was still there.
+	bool Reclaim(std::size_t index, Task* task);
+	std::size_t GetQueueIndex() const;
+	Task* Take(std::size_t index);
+	static void Run(Task* task);
+};
@@ -1,98 +1,471 @@
 ﻿#include <iostream>
 #include <exception>
 #include <algorithm> 
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <cstdint>
 
-template <class type> 
-class TString;
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
-template <class type>
-typename TString<type>::RandomAccessIterator operator+ (long long int num, const typename TString<type>::RandomAccessIterator& rai);
+namespace StringDetails {
+	const std::size_t npos = static_cast<std::size_t>(-1);
 
-template <class type>
-class TString {
-public:
-	class RandomAccessIterator : public std::iterator<std::random_access_iterator_tag, type> {
-		using Super = std::iterator<std::random_access_iterator_tag, type>;
-	public:
-		RandomAccessIterator() : data(nullptr) {}
-		explicit RandomAccessIterator(type* pointer, std::size_t index) : data(pointer) {}
+	inline unsigned CountTrailingZeros(unsigned mask) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+	inline unsigned HighestBit(unsigned mask) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanReverse(&index, mask);
+		return index;
+#else
+		return 31 - __builtin_clz(mask);
+#endif
+	}
 
-		RandomAccessIterator& operator++ () { 
-			data += 1; 
-			return *this; 
-		}
-		RandomAccessIterator& operator-- () { 
-			data -= 1; 
-			return *this;
-		}
-		RandomAccessIterator operator++ (int) {
-			auto old = *this;
-			data += 1;
-			return old;
-		}
-		RandomAccessIterator operator-- (int) { 
-			auto old = *this; 
-			data -= 1; 
-			return old; 
-		}
-		Super::difference_type operator- (const RandomAccessIterator& other) const {
-			return data - other.data;
-		}
-		Super::reference operator* () const {
-			return *data;
-		}
-		bool operator== (const RandomAccessIterator& other) const {
-			return data == other.data;
+	// One vector register compared element-wise for characters of 1, 2 or 4 bytes. Mask() gives a
+	// bit per byte, so every character sets sizeof(type) bits.
+#if defined(__AVX2__)
+	struct Lanes {
+		using Vector = __m256i;
+		static const std::size_t bytes = 32;
+		static const unsigned fullMask = 0xFFFFFFFFu;
+
+		static Vector Load(const void* source) { return _mm256_loadu_si256(static_cast<const __m256i*>(source)); }
+		static Vector And(Vector a, Vector b) { return _mm256_and_si256(a, b); }
+		static unsigned Mask(Vector v) { return static_cast<unsigned>(_mm256_movemask_epi8(v)); }
+		template <class type>
+		static Vector Broadcast(type value) {
+			if constexpr (sizeof(type) == 1) return _mm256_set1_epi8(static_cast<char>(value));
+			else if constexpr (sizeof(type) == 2) return _mm256_set1_epi16(static_cast<short>(value));
+			else return _mm256_set1_epi32(static_cast<int>(value));
+		}
+		template <class type>
+		static Vector Equal(Vector a, Vector b) {
+			if constexpr (sizeof(type) == 1) return _mm256_cmpeq_epi8(a, b);
+			else if constexpr (sizeof(type) == 2) return _mm256_cmpeq_epi16(a, b);
+			else return _mm256_cmpeq_epi32(a, b);
 		}
-		bool operator!= (const RandomAccessIterator& other) const {
-			return !(*this == other);
+	};
+#elif defined(__SSE2__)
+	struct Lanes {
+		using Vector = __m128i;
+		static const std::size_t bytes = 16;
+		static const unsigned fullMask = 0xFFFFu;
+
+		static Vector Load(const void* source) { return _mm_loadu_si128(static_cast<const __m128i*>(source)); }
+		static Vector And(Vector a, Vector b) { return _mm_and_si128(a, b); }
+		static unsigned Mask(Vector v) { return static_cast<unsigned>(_mm_movemask_epi8(v)); }
+		template <class type>
+		static Vector Broadcast(type value) {
+			if constexpr (sizeof(type) == 1) return _mm_set1_epi8(static_cast<char>(value));
+			else if constexpr (sizeof(type) == 2) return _mm_set1_epi16(static_cast<short>(value));
+			else return _mm_set1_epi32(static_cast<int>(value));
+		}
+		template <class type>
+		static Vector Equal(Vector a, Vector b) {
+			if constexpr (sizeof(type) == 1) return _mm_cmpeq_epi8(a, b);
+			else if constexpr (sizeof(type) == 2) return _mm_cmpeq_epi16(a, b);
+			else return _mm_cmpeq_epi32(a, b);
 		}
-		bool operator< (const RandomAccessIterator& other) const {
-			return other - *this > 0;
+	};
+#endif
+
+	template <class type>
+	constexpr bool IsVectorized() {
+#if defined(__AVX2__) || defined(__SSE2__)
+		return sizeof(type) == 1 || sizeof(type) == 2 || sizeof(type) == 4;
+#else
+		return false;
+#endif
+	}
+
+	// Index of the first position where a and b differ, or size.
+	template <class type>
+	std::size_t Mismatch(const type* a, const type* b, std::size_t size) {
+		std::size_t index = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+		if constexpr (IsVectorized<type>()) {
+			const std::size_t step = Lanes::bytes / sizeof(type);
+			for (; index + step <= size; index += step) {
+				unsigned mask = Lanes::Mask(Lanes::Equal<type>(Lanes::Load(a + index), Lanes::Load(b + index)));
+				if (mask != Lanes::fullMask) {
+					return index + CountTrailingZeros(~mask) / sizeof(type);
+				}
+			}
 		}
-		bool operator> (const RandomAccessIterator& other) const {
-			return *this - other > 0;
+#endif
+		while (index < size && a[index] == b[index]) {
+			index++;
 		}
-		bool operator<= (const RandomAccessIterator& other) const {
-			return !(*this > other);
+		return index;
+	}
+
+	// Both ends of the needle are compared with a register of candidate positions at once (Mula,
+	// "SIMD-friendly algorithms for substring searching"); only positions where both match are
+	// compared in full. Returns the first match at or after position, or npos.
+	template <class type>
+	std::size_t Find(const type* data, std::size_t size, const type* needle, std::size_t needleSize, std::size_t position) {
+		if (needleSize > size || position > size - needleSize) {
+			return npos;
+		}
+		if (needleSize == 0) {
+			return position;
+		}
+		std::size_t last = size - needleSize;
+		std::size_t index = position;
+#if defined(__AVX2__) || defined(__SSE2__)
+		if constexpr (IsVectorized<type>()) {
+			const std::size_t step = Lanes::bytes / sizeof(type);
+			const typename Lanes::Vector first = Lanes::Broadcast(needle[0]);
+			const typename Lanes::Vector final = Lanes::Broadcast(needle[needleSize - 1]);
+			for (; index <= last && last - index + 1 >= step; index += step) {
+				unsigned mask = Lanes::Mask(Lanes::And(Lanes::Equal<type>(first, Lanes::Load(data + index)),
+					Lanes::Equal<type>(final, Lanes::Load(data + index + needleSize - 1))));
+				while (mask != 0) {
+					unsigned bit = CountTrailingZeros(mask);
+					std::size_t candidate = index + bit / sizeof(type);
+					if (needleSize <= 2 || std::char_traits<type>::compare(data + candidate + 1, needle + 1, needleSize - 2) == 0) {
+						return candidate;
+					}
+					mask &= ~(((1u << sizeof(type)) - 1) << bit);
+				}
+			}
 		}
-		bool operator>= (const RandomAccessIterator& other) const {
-			return !(*this < other);
+#endif
+		for (; index <= last; index++) {
+			if (data[index] == needle[0] && std::char_traits<type>::compare(data + index, needle, needleSize) == 0) {
+				return index;
+			}
 		}
-		RandomAccessIterator operator+ (long long int num) const {
-			RandomAccessIterator i{ *this };
-			i += num;
-			return i;
+		return npos;
+	}
+
+	// Like Find(), but returns the last match that starts at or before position.
+	template <class type>
+	std::size_t RFind(const type* data, std::size_t size, const type* needle, std::size_t needleSize, std::size_t position) {
+		if (needleSize > size) {
+			return npos;
+		}
+		std::size_t end = std::min(position, size - needleSize) + 1;
+		if (needleSize == 0) {
+			return end - 1;
+		}
+#if defined(__AVX2__) || defined(__SSE2__)
+		if constexpr (IsVectorized<type>()) {
+			const std::size_t step = Lanes::bytes / sizeof(type);
+			const typename Lanes::Vector first = Lanes::Broadcast(needle[0]);
+			const typename Lanes::Vector final = Lanes::Broadcast(needle[needleSize - 1]);
+			for (; end >= step; end -= step) {
+				std::size_t index = end - step;
+				unsigned mask = Lanes::Mask(Lanes::And(Lanes::Equal<type>(first, Lanes::Load(data + index)),
+					Lanes::Equal<type>(final, Lanes::Load(data + index + needleSize - 1))));
+				while (mask != 0) {
+					unsigned element = HighestBit(mask) / sizeof(type);
+					std::size_t candidate = index + element;
+					if (needleSize <= 2 || std::char_traits<type>::compare(data + candidate + 1, needle + 1, needleSize - 2) == 0) {
+						return candidate;
+					}
+					mask &= ~(((1u << sizeof(type)) - 1) << (element * sizeof(type)));
+				}
+			}
 		}
-		RandomAccessIterator operator- (long long int num) const {
-			RandomAccessIterator i{ *this };
-			i -= num;
-			return i;
+#endif
+		while (end-- > 0) {
+			if (data[end] == needle[0] && std::char_traits<type>::compare(data + end, needle, needleSize) == 0) {
+				return end;
+			}
 		}
-		RandomAccessIterator& operator+= (long long int num) {
-			data += num;
-			return *this;
+		return npos;
+	}
+
+	// wyhash (Wang Yi, final version 4): reads 16 bytes per multiply, 48 per step on long keys.
+	inline void MultiplyWide(std::uint64_t& a, std::uint64_t& b) {
+#ifdef __SIZEOF_INT128__
+		unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+		a = static_cast<std::uint64_t>(product);
+		b = static_cast<std::uint64_t>(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		a = _umul128(a, b, &b);
+#else
+		std::uint64_t a_hi = a >> 32, a_lo = static_cast<std::uint32_t>(a);
+		std::uint64_t b_hi = b >> 32, b_lo = static_cast<std::uint32_t>(b);
+		std::uint64_t hi_hi = a_hi * b_hi, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, lo_lo = a_lo * b_lo;
+		std::uint64_t middle = hi_lo + (lo_lo >> 32) + static_cast<std::uint32_t>(lo_hi);
+		a = (middle << 32) | static_cast<std::uint32_t>(lo_lo);
+		b = hi_hi + (middle >> 32) + (lo_hi >> 32);
+#endif
+	}
+	inline std::uint64_t Mix(std::uint64_t a, std::uint64_t b) {
+		MultiplyWide(a, b);
+		return a ^ b;
+	}
+	inline std::uint64_t Read8(const unsigned char* p) {
+		std::uint64_t value;
+		std::memcpy(&value, p, 8);
+		return value;
+	}
+	inline std::uint64_t Read4(const unsigned char* p) {
+		std::uint32_t value;
+		std::memcpy(&value, p, 4);
+		return value;
+	}
+	inline std::uint64_t Hash(const void* key, std::size_t length, std::uint64_t seed = 0) {
+		static const std::uint64_t secret[4] = { 0x2D358DCCAA6C78A5, 0x8BB84B93962EACC9, 0x4B33A62ED433D4A3, 0x4D5A2DA51DE1AA47 };
+		const unsigned char* p = static_cast<const unsigned char*>(key);
+		seed ^= Mix(seed ^ secret[0], secret[1]);
+		std::uint64_t a, b;
+		if (length <= 16) {
+			if (length >= 4) {
+				a = (Read4(p) << 32) | Read4(p + ((length >> 3) << 2));
+				b = (Read4(p + length - 4) << 32) | Read4(p + length - 4 - ((length >> 3) << 2));
+			}
+			else if (length > 0) {
+				a = (std::uint64_t(p[0]) << 16) | (std::uint64_t(p[length >> 1]) << 8) | p[length - 1];
+				b = 0;
+			}
+			else {
+				a = b = 0;
+			}
 		}
-		RandomAccessIterator& operator-= (long long int num) {
-			data -= num;
-			return *this;
+		else {
+			std::size_t rest = length;
+			if (rest > 48) {
+				std::uint64_t seed1 = seed, seed2 = seed;
+				do {
+					seed = Mix(Read8(p) ^ secret[1], Read8(p + 8) ^ seed);
+					seed1 = Mix(Read8(p + 16) ^ secret[2], Read8(p + 24) ^ seed1);
+					seed2 = Mix(Read8(p + 32) ^ secret[3], Read8(p + 40) ^ seed2);
+					p += 48;
+					rest -= 48;
+				} while (rest > 48);
+				seed ^= seed1 ^ seed2;
+			}
+			while (rest > 16) {
+				seed = Mix(Read8(p) ^ secret[1], Read8(p + 8) ^ seed);
+				rest -= 16;
+				p += 16;
+			}
+			a = Read8(p + rest - 16);
+			b = Read8(p + rest - 8);
 		}
-		Super::reference operator[] (std::size_t index) {
-			return *(*this + index);
+		a ^= secret[1];
+		b ^= seed;
+		MultiplyWide(a, b);
+		return Mix(a ^ secret[0] ^ length, b ^ secret[1]);
+	}
+}
+
+// Iterates over the characters of a TString, or of a TStringView with a const type.
+template <class type>
+class TRandomAccessIterator {
+public:
+	using iterator_category = std::random_access_iterator_tag;
+	using value_type = std::remove_const_t<type>;
+	using difference_type = std::ptrdiff_t;
+	using pointer = type*;
+	using reference = type&;
+
+	TRandomAccessIterator() : data(nullptr) {}
+	explicit TRandomAccessIterator(type* pointer, std::size_t index) : data(pointer) {}
+	// A string iterator converts to a view (const) iterator.
+	template <class otherType, class = std::enable_if_t<std::is_same_v<const otherType, type>>>
+	TRandomAccessIterator(const TRandomAccessIterator<otherType>& other) : data(other.data) {}
+
+	TRandomAccessIterator& operator++ () { 
+		data += 1; 
+		return *this; 
+	}
+	TRandomAccessIterator& operator-- () { 
+		data -= 1; 
+		return *this;
+	}
+	TRandomAccessIterator operator++ (int) {
+		auto old = *this;
+		data += 1;
+		return old;
+	}
+	TRandomAccessIterator operator-- (int) { 
+		auto old = *this; 
+		data -= 1; 
+		return old; 
+	}
+	difference_type operator- (const TRandomAccessIterator& other) const {
+		return data - other.data;
+	}
+	reference operator* () const {
+		return *data;
+	}
+	bool operator== (const TRandomAccessIterator& other) const {
+		return data == other.data;
+	}
+	bool operator!= (const TRandomAccessIterator& other) const {
+		return !(*this == other);
+	}
+	bool operator< (const TRandomAccessIterator& other) const {
+		return other - *this > 0;
+	}
+	bool operator> (const TRandomAccessIterator& other) const {
+		return *this - other > 0;
+	}
+	bool operator<= (const TRandomAccessIterator& other) const {
+		return !(*this > other);
+	}
+	bool operator>= (const TRandomAccessIterator& other) const {
+		return !(*this < other);
+	}
+	TRandomAccessIterator operator+ (long long int num) const {
+		TRandomAccessIterator i{ *this };
+		i += num;
+		return i;
+	}
+	TRandomAccessIterator operator- (long long int num) const {
+		TRandomAccessIterator i{ *this };
+		i -= num;
+		return i;
+	}
+	TRandomAccessIterator& operator+= (long long int num) {
+		data += num;
+		return *this;
+	}
+	TRandomAccessIterator& operator-= (long long int num) {
+		data -= num;
+		return *this;
+	}
+	reference operator[] (std::size_t index) {
+		return *(*this + index);
+	}
+	friend TRandomAccessIterator operator+ (long long int num, const TRandomAccessIterator& rai) {
+		return rai + num;
+	}
+private:
+	template <class otherType>
+	friend class TRandomAccessIterator;
+
+	type* data;
+};
+
+template <class type>
+class TString;
+
+// Non-owning, read-only range of characters: a pointer and a length, not null-terminated.
+// Must not outlive the characters it refers to.
+template <class type>
+class TStringView {
+public:
+	using ConstRandomAccessIterator = TRandomAccessIterator<const type>;
+	static const std::size_t npos = StringDetails::npos;
+
+	TStringView() noexcept : data(nullptr), size(0) {}
+	TStringView(const type* data, std::size_t size) noexcept : data(data), size(size) {}
+	TStringView(const type* stringToView) : TStringView(stringToView, std::char_traits<type>::length(stringToView)) {}
+	TStringView(ConstRandomAccessIterator first, ConstRandomAccessIterator last) : data(first == last ? nullptr : &*first), size(last - first) {}
+
+	const type* GetData() const noexcept {
+		return data;
+	}
+	std::size_t GetSize() const noexcept {
+		return size;
+	}
+	bool IsEmpty() const noexcept {
+		return size == 0;
+	}
+	const type& operator[] (std::size_t index) const {
+		return data[index];
+	}
+
+	// The count characters from position on, or fewer at the end; throws OutOfRange past the end.
+	TStringView Substr(std::size_t position, std::size_t count = npos) const {
+		if (position > size) {
+			throw typename TString<type>::OutOfRange();
 		}
-	private:
-		type* data;
-	};
+		return TStringView(data + position, std::min(count, size - position));
+	}
+
+	std::size_t Find(TStringView stringToFind, std::size_t position = 0) const {
+		return StringDetails::Find(data, size, stringToFind.data, stringToFind.size, position);
+	}
+	std::size_t Find(const type charToFind, std::size_t position = 0) const {
+		return StringDetails::Find(data, size, &charToFind, 1, position);
+	}
+	std::size_t RFind(TStringView stringToFind, std::size_t position = npos) const {
+		return StringDetails::RFind(data, size, stringToFind.data, stringToFind.size, position);
+	}
+	std::size_t RFind(const type charToFind, std::size_t position = npos) const {
+		return StringDetails::RFind(data, size, &charToFind, 1, position);
+	}
+	bool Contains(TStringView stringToFind) const {
+		return Find(stringToFind) != npos;
+	}
+	bool Contains(const type charToFind) const {
+		return Find(charToFind) != npos;
+	}
+	// Lexicographic comparison: negative, zero or positive like std::char_traits::compare.
+	int Compare(TStringView other) const {
+		std::size_t commonSize = std::min(size, other.size);
+		std::size_t index = StringDetails::Mismatch(data, other.data, commonSize);
+		if (index < commonSize) {
+			return std::char_traits<type>::lt(data[index], other.data[index]) ? -1 : 1;
+		}
+		return size < other.size ? -1 : (size > other.size ? 1 : 0);
+	}
+	// Equal to the hash of a TString with the same characters.
+	std::size_t GetHash() const noexcept {
+		return static_cast<std::size_t>(StringDetails::Hash(data, size * sizeof(type)));
+	}
+
+	ConstRandomAccessIterator begin() const {
+		return ConstRandomAccessIterator(data, 0);
+	}
+	ConstRandomAccessIterator end() const {
+		return ConstRandomAccessIterator(data + size, size);
+	}
+
+	// Not templates, so that a TString or a C string on either side converts to a view.
+	friend bool operator== (TStringView view1, TStringView view2) {
+		return view1.size == view2.size && StringDetails::Mismatch(view1.data, view2.data, view1.size) == view1.size;
+	}
+	friend bool operator!= (TStringView view1, TStringView view2) {
+		return !(view1 == view2);
+	}
+	friend bool operator< (TStringView view1, TStringView view2) {
+		return view1.Compare(view2) < 0;
+	}
+private:
+	const type* data;
+	std::size_t size;
+};
+
+template <class type>
+class TString {
+public:
+	using RandomAccessIterator = TRandomAccessIterator<type>;
+	using ConstRandomAccessIterator = TRandomAccessIterator<const type>;
+
 	class OutOfRange : public std::exception {
 	public:
 		OutOfRange() {}
-		const char* what() const override {
+		const char* what() const noexcept override {
 			return "Out of range";
 		}
 	};
-	TString() : smallString(), isSmallString(true) {
-		smallString.data[0] = '\0';
-		smallString.size = 1;
+	TString() : largeString{} {
+		SetSmallSize(0);
 	}
 	TString(const type* stringToPut) : TString() {
 		Append(stringToPut);
@@ -103,6 +476,9 @@ public:
 	TString(const TString& other) : TString() {
 		Append(other);
 	}
+	explicit TString(TStringView<type> view) : TString() {
+		Append(view);
+	}
 	TString(TString&& other) noexcept : TString() {
 		Swap(*this, other);
 	}
@@ -120,169 +496,231 @@ public:
 		return *this;
 	}
 
+	// Makes room for newCapacity characters besides the terminating null.
 	void Reserve(std::size_t newCapacity) { 
-		if ((isSmallString && newCapacity < smallStringCapacity) || (!isSmallString && newCapacity < largeString.size)) { 
+		if (newCapacity <= GetCapacity()) { 
 			return; 
 		}
-		if (isSmallString) {
-			TransformSmallToLarge(newCapacity);
-		}
-		else {
-			type* newData = new type[newCapacity];
-			largeString.capacity = newCapacity;
-			CopyData(newData, largeString.data, largeString.size);
+		std::size_t size = GetSize();
+		type* newData = new type[newCapacity + 1];
+		CopyData(newData, GetCString(), size + 1);
+		if (IsLargeString()) {
 			delete[] largeString.data;
-			largeString.data = newData;
 		}
+		largeString.data = newData;
+		largeString.size = size;
+		SetLargeCapacity(newCapacity);
 	}
 	void Append(const TString& stringToPut) {
-		Append(stringToPut.GetCString());
+		Append(stringToPut.GetCString(), stringToPut.GetSize());
 	}
 	void Append(const type* stringToPut) {
-		std::size_t stringToPutSize = std::char_traits<type>::length(stringToPut);
-		if (isSmallString && (stringToPutSize + smallString.size) < smallStringCapacity) {
-			std::size_t size = smallString.size;
-			Push(stringToPut, stringToPutSize, smallString.data, size);
-			smallString.size = size;
-			return;
-		}
-		if (isSmallString) {
-			TransformSmallToLarge(smallStringCapacity + stringToPutSize + 1);
-		}
-		else if ((stringToPutSize + largeString.size) > largeString.capacity) {
-			Reserve(largeString.capacity + stringToPutSize + 1);
-		}
-		Push(stringToPut, stringToPutSize, largeString.data, largeString.size);
+		Append(stringToPut, std::char_traits<type>::length(stringToPut));
 	}
-	void PopBack() {
-		if (!isSmallString) {
-			largeString.size--;
-			largeString.data[largeString.size - 1] = '\0'; 
-			if (largeString.size <= smallStringCapacity) {
-				TransformLargeToSmall();
+	void Append(TStringView<type> stringToPut) {
+		Append(stringToPut.GetData(), stringToPut.GetSize());
+	}
+	// Appends stringToPutSize characters, which may come from this string itself. The capacity
+	// grows by half at least, so a series of appends copies every character O(1) times.
+	void Append(const type* stringToPut, std::size_t stringToPutSize) {
+		std::size_t size = GetSize();
+		std::size_t newSize = size + stringToPutSize;
+		if (newSize > GetCapacity()) {
+			const type* data = GetCString();
+			bool isOwnData = !std::less<const type*>()(stringToPut, data) && std::less<const type*>()(stringToPut, data + size + 1);
+			std::size_t offset = isOwnData ? stringToPut - data : 0;
+			Reserve(std::max(newSize, GetCapacity() + GetCapacity() / 2));
+			if (isOwnData) {
+				stringToPut = largeString.data + offset;
 			}
-			return;
 		}
-		if (smallString.size == 1) {
+		std::memmove(GetData() + size, stringToPut, stringToPutSize * sizeof(type));
+		SetSize(newSize);
+	}
+	void PopBack() {
+		std::size_t size = GetSize();
+		if (size == 0) {
 			throw OutOfRange();
 		}
-		smallString.size--;
-		smallString.data[smallString.size - 1] = '\0'; 	
+		SetSize(size - 1);
+		if (IsLargeString() && size - 1 <= smallStringCapacity) {
+			TransformLargeToSmall();
+		}
 	}
 	void PushBack(const type charToPut) {
-		type stringToPut[2];
-		stringToPut[0] = charToPut;
-		stringToPut[1] = '\0';
-		Append(stringToPut);
+		Append(&charToPut, 1);
 	}
+	// LargeString spans every byte of the union, so swapping it swaps small strings too.
 	static void Swap(TString& string1, TString& string2) noexcept
 	{
-		if (string2.isSmallString) {
-			std::swap(string1.smallString.size, string2.smallString.size);
-			std::swap(string1.smallString.data, string2.smallString.data);
-		}
-		else {
-			std::swap(string1.largeString.size, string2.largeString.size);
-			std::swap(string1.largeString.capacity, string2.largeString.capacity);
-			std::swap(string1.largeString.data, string2.largeString.data);
-		}
-		std::swap(string1.isSmallString, string2.isSmallString);
+		std::swap(string1.largeString, string2.largeString);
 	}
 	void Clear() {
-		if (!isSmallString) {
+		if (IsLargeString()) {
 			delete[] largeString.data;
-			isSmallString = true;
 		}
-		smallString.size = 1;
-		smallString.data[0] = '\0';
+		SetSmallSize(0);
 	}
 
 	const type* GetCString() const {
-		if (isSmallString) {
-			return smallString.data;
+		if (IsLargeString()) {
+			return largeString.data;
 		}
-		return largeString.data;
+		return smallString.data;
 	}
 	std::size_t GetSize() const noexcept {
-		if (isSmallString) {
-			return smallString.size - 1;
+		if (IsLargeString()) {
+			return largeString.size;
 		}
-		return largeString.size - 1;
+		return smallStringCapacity - static_cast<std::size_t>(smallString.data[smallStringCapacity]);
 	}
 	std::size_t GetCapacity() const noexcept {
-		if (isSmallString) {
-			return smallStringCapacity;
+		if (IsLargeString()) {
+			return (largeString.capacity & ~largeFlag) >> capacityShift;
 		}
-		return largeString.capacity;
+		return smallStringCapacity;
+	}
+
+	static const std::size_t npos = StringDetails::npos;
+
+	// Position of the first occurrence at or after position, or npos. As in std::string, the
+	// length of a pointer argument comes last, so Find(pointer, n) always starts from position n.
+	std::size_t Find(const type* stringToFind, std::size_t position, std::size_t stringToFindSize) const {
+		return StringDetails::Find(GetCString(), GetSize(), stringToFind, stringToFindSize, position);
+	}
+	std::size_t Find(TStringView<type> stringToFind, std::size_t position = 0) const {
+		return Find(stringToFind.GetData(), position, stringToFind.GetSize());
+	}
+	std::size_t Find(const type* stringToFind, std::size_t position = 0) const {
+		return Find(stringToFind, position, std::char_traits<type>::length(stringToFind));
+	}
+	std::size_t Find(const type charToFind, std::size_t position = 0) const {
+		return Find(&charToFind, position, 1);
+	}
+	// Position of the last occurrence starting at or before position, or npos.
+	std::size_t RFind(const type* stringToFind, std::size_t position, std::size_t stringToFindSize) const {
+		return StringDetails::RFind(GetCString(), GetSize(), stringToFind, stringToFindSize, position);
+	}
+	std::size_t RFind(TStringView<type> stringToFind, std::size_t position = npos) const {
+		return RFind(stringToFind.GetData(), position, stringToFind.GetSize());
+	}
+	std::size_t RFind(const type* stringToFind, std::size_t position = npos) const {
+		return RFind(stringToFind, position, std::char_traits<type>::length(stringToFind));
+	}
+	std::size_t RFind(const type charToFind, std::size_t position = npos) const {
+		return RFind(&charToFind, position, 1);
+	}
+	bool Contains(TStringView<type> stringToFind) const {
+		return Find(stringToFind) != npos;
+	}
+	bool Contains(const type* stringToFind) const {
+		return Find(stringToFind) != npos;
+	}
+	bool Contains(const type charToFind) const {
+		return Find(charToFind) != npos;
+	}
+
+	// Lexicographic comparison: negative, zero or positive like std::char_traits::compare.
+	int Compare(const type* other, std::size_t otherSize) const {
+		std::size_t size = GetSize();
+		std::size_t commonSize = std::min(size, otherSize);
+		std::size_t index = StringDetails::Mismatch(GetCString(), other, commonSize);
+		if (index < commonSize) {
+			return std::char_traits<type>::lt(GetCString()[index], other[index]) ? -1 : 1;
+		}
+		return size < otherSize ? -1 : (size > otherSize ? 1 : 0);
+	}
+	int Compare(TStringView<type> other) const {
+		return Compare(other.GetData(), other.GetSize());
+	}
+	int Compare(const type* other) const {
+		return Compare(other, std::char_traits<type>::length(other));
+	}
+	std::size_t GetHash() const noexcept {
+		return static_cast<std::size_t>(StringDetails::Hash(GetCString(), GetSize() * sizeof(type)));
+	}
+
+	// Views the count characters from position on, or fewer at the end, without copying; the view
+	// is invalidated by anything that changes the string. Throws OutOfRange past the end.
+	TStringView<type> Substr(std::size_t position, std::size_t count = npos) const {
+		return TStringView<type>(*this).Substr(position, count);
+	}
+	operator TStringView<type>() const noexcept {
+		return TStringView<type>(GetCString(), GetSize());
 	}
 
 	RandomAccessIterator begin() {
-		if (isSmallString) {
-			return RandomAccessIterator(smallString.data, 0);
-		}
-		return RandomAccessIterator(largeString.data, 0);
+		return RandomAccessIterator(GetData(), 0);
 	}
 	RandomAccessIterator end() { 
-		if (isSmallString) {
-			return RandomAccessIterator(smallString.data + smallString.size - 1, smallString.size - 1);
-		}
-		return RandomAccessIterator(largeString.data + largeString.size - 1, largeString.size - 1);
+		return RandomAccessIterator(GetData() + GetSize(), GetSize());
+	}
+	ConstRandomAccessIterator begin() const {
+		return ConstRandomAccessIterator(GetCString(), 0);
+	}
+	ConstRandomAccessIterator end() const {
+		return ConstRandomAccessIterator(GetCString() + GetSize(), GetSize());
 	}
 private:
 	// Methods	
 	static void CopyData(type* string1, const type* string2, std::size_t string2Size) {
-		for (std::size_t index = 0; index < string2Size; index++)
-		{
-			string1[index] = string2[index];
-		}
-	}
-	void TransformSmallToLarge(std::size_t newCapacity) {
-		isSmallString = false;
-		if (smallString.size > 1) {
-			type* tempData = new type[newCapacity];
-			CopyData(tempData, smallString.data, smallString.size);
-			largeString.size = smallString.size;
-			largeString.capacity = newCapacity;			
-			largeString.data = tempData;
+		std::memcpy(string1, string2, string2Size * sizeof(type));
+	}
+	type* GetData() {
+		return const_cast<type*>(GetCString());
+	}
+	bool IsLargeString() const noexcept {
+		return (reinterpret_cast<const unsigned char*>(&largeString)[sizeof(LargeString) - 1] & 0x80) != 0;
+	}
+	void SetLargeCapacity(std::size_t capacity) {
+		largeString.capacity = (capacity << capacityShift) | largeFlag;
+	}
+	// The last slot holds the number of free slots, so it is the terminating null when the string is full.
+	void SetSmallSize(std::size_t size) {
+		smallString.data[size] = '\0';
+		smallString.data[smallStringCapacity] = static_cast<type>(smallStringCapacity - size);
+	}
+	void SetSize(std::size_t size) {
+		if (IsLargeString()) {
+			largeString.size = size;
+			largeString.data[size] = '\0';
 			return;
 		}
-		largeString.size = smallString.size;
-		largeString.capacity = newCapacity;
-		largeString.data = new type[largeString.capacity];
-		largeString.data[0] = '\0';
+		SetSmallSize(size);
 	}
 	void TransformLargeToSmall() {
-		isSmallString = true;
 		type* data = largeString.data;
-		char size = largeString.size;
+		std::size_t size = largeString.size;
 		CopyData(smallString.data, data, size);
-		smallString.size = size;
+		SetSmallSize(size);
 		delete[] data;
 	}
-	static void Push(const type* stringToPut, std::size_t stringToPutSize, type* mainString, std::size_t& stringToPutInSize) {
-		stringToPutInSize--;
-		for (std::size_t index1 = stringToPutInSize, index2 = 0; index2 < stringToPutSize; index1++, index2++) {
-			mainString[index1] = stringToPut[index2];
-			stringToPutInSize++;
-		}
-		mainString[stringToPutInSize] = '\0';
-		stringToPutInSize++;
-	}
 
 	// Structs, classes and static data
 	struct LargeString {
-		type* data = nullptr;
-		std::size_t size = 0;
-		std::size_t capacity = 0;
+		type* data;
+		std::size_t size;
+		// Tagged with largeFlag, which falls into the last byte of the object.
+		std::size_t capacity;
 	};
+	// The characters fill the object except for its last slot, which is shared with the size.
 	static const std::size_t smallStringCapacity = (sizeof(LargeString) / sizeof(type)) - 1;
 	struct SmallString {
-		char size = 0;
-		type data[smallStringCapacity];
+		type data[smallStringCapacity + 1];
 	};
+	static_assert(sizeof(SmallString) == sizeof(LargeString), "The small string must overlay the large one exactly");
+	// A small string keeps at most smallStringCapacity in its last slot, which leaves the top bit
+	// of the last byte free to mark large strings; where that byte lies in capacity depends on
+	// the byte order.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	static const int capacityShift = 8;
+	static const std::size_t largeFlag = 0x80;
+#else
+	static const int capacityShift = 0;
+	static const std::size_t largeFlag = std::size_t(1) << (sizeof(std::size_t) * 8 - 1);
+#endif
 
 	// Data
-	bool isSmallString;
 	union {
 		LargeString largeString;
 		SmallString smallString;
@@ -290,17 +728,42 @@ private:
 };
 
 template <class type>
-typename TString<type>::RandomAccessIterator operator+ (long long int num, const typename TString<type>::RandomAccessIterator& rai) {
-	return rai + num;
+bool operator== (const TString<type>& string1, const TString<type>& string2) {
+	return string1.GetSize() == string2.GetSize() && StringDetails::Mismatch(string1.GetCString(), string2.GetCString(), string1.GetSize()) == string1.GetSize();
+}
+template <class type>
+bool operator!= (const TString<type>& string1, const TString<type>& string2) {
+	return !(string1 == string2);
+}
+template <class type>
+bool operator< (const TString<type>& string1, const TString<type>& string2) {
+	return string1.Compare(string2) < 0;
+}
+
+namespace std {
+	template <class type>
+	struct hash<TString<type>> {
+		std::size_t operator() (const TString<type>& string) const noexcept {
+			return string.GetHash();
+		}
+	};
+	template <class type>
+	struct hash<TStringView<type>> {
+		std::size_t operator() (TStringView<type> view) const noexcept {
+			return view.GetHash();
+		}
+	};
 }
 
 using String = TString<char>;
 using WString = TString<wchar_t>;
+using StringView = TStringView<char>;
+using WStringView = TStringView<wchar_t>;
 
 int main() {
 	try {
 		String ssSample{ "I am Yumiko" }; // Constructor1 check, Append(const char*) check, Push() check;
-		String lsSample{ "I am Yumiko and my dream is to be a programmer!!" }; // TransformSmallToLarge() check;
+		String lsSample{ "I am Yumiko and my dream is to be a programmer!!" }; // Small to large transition check;
 		String charSample{ '!' }; // Constructor2 check;
 		ssSample.Append(charSample); // Append(const String&) check
 		ssSample.PushBack(' '); // PushBack() check;
@@ -344,13 +807,24 @@ int main() {
 			<< "\nString capacity: " << empty1.GetCapacity() << "\n";
 		std::sort(testString4.begin(), testString4.end()); // RAI check;
 		std::wcout << testString4.GetCString();
+		std::wcout << "\nFind: " << lsSample.Find("dream") << ' ' << lsSample.Find("am", 3) << ' ' << lsSample.Find("amX", 3, 2) // Find() check;
+			<< "\nRFind: " << lsSample.RFind('m') << ' ' << lsSample.RFind("m", 20) // RFind() check;
+			<< "\nContains: " << lsSample.Contains("Yumiko") // Contains() check;
+			<< "\nCompare: " << ssSample.Compare(ssMove) << ' ' << (ssMove == lsMove) // Compare(), operator== check;
+			<< "\nHash: " << ssMove.GetHash() << "\n"; // GetHash() check;
+		StringView svWord = lsSample.Substr(5, 6); // Substr() check;
+		String svCopy{ svWord }; // Constructor from view check;
+		svCopy.Append(svCopy.Substr(0, 3)); // Append(view) check;
+		std::wcout << "View: " << String{ svWord }.GetCString()
+			<< "\nFind view: " << lsSample.Find(svWord)
+			<< "\nView compare: " << (svWord == ssSample.Substr(5, 6)) << ' ' << (svWord == svCopy) << ' ' << (svCopy != svWord) << ' ' << (svWord < lsSample) << ' ' << svCopy.GetCString() << "\n";
 	}
 	catch (String::OutOfRange e) {
 		std::wcout << "Exception caught: " << e.what() << '\n';
 	}
 	try {
 		WString wssSample{ L"I am Yumiko" }; // Constructor1 check, Append(const char*) check, Push() check;
-		WString wlsSample{ L"I am Yumiko and my dream is to be a programmer!!" }; // TransformSmallToLarge() check;
+		WString wlsSample{ L"I am Yumiko and my dream is to be a programmer!!" }; // Small to large transition check;
 		WString wcharSample{ L'!' }; // Constructor2 check;
 		wssSample.Append(wcharSample); // Append(const String&) check
 		wssSample.PushBack(L' '); // PushBack() check;
@@ -394,6 +868,17 @@ int main() {
 			<< "\nWString capacity: " << wempty1.GetCapacity() << "\n";
 		std::sort(wtestString4.begin(), wtestString4.end()); // RAI check;
 		std::wcout << wtestString4.GetCString();
+		std::wcout << "\nFind: " << wlsSample.Find(L"dream") << ' ' << wlsSample.Find(L"am", 3) << ' ' << wlsSample.Find(L"amX", 3, 2)
+			<< "\nRFind: " << wlsSample.RFind(L'm') << ' ' << wlsSample.RFind(L"m", 20)
+			<< "\nContains: " << wlsSample.Contains(L"Yumiko")
+			<< "\nCompare: " << wssSample.Compare(wssMove) << ' ' << (wssMove == wlsMove)
+			<< "\nHash: " << wssMove.GetHash() << "\n";
+		WStringView wsvWord = wlsSample.Substr(5, 6);
+		WString wsvCopy{ wsvWord };
+		wsvCopy.Append(wsvCopy.Substr(0, 3));
+		std::wcout << "View: " << WString{ wsvWord }.GetCString()
+			<< "\nFind view: " << wlsSample.Find(wsvWord)
+			<< "\nView compare: " << (wsvWord == wssSample.Substr(5, 6)) << ' ' << (wsvWord == wsvCopy) << ' ' << (wsvCopy != wsvWord) << ' ' << (wsvWord < wlsSample) << ' ' << wsvCopy.GetCString() << "\n";
 	}
 	catch (WString::OutOfRange e) {
 		std::wcout << "Exception caught: " << e.what() << '\n';